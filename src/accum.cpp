@@ -0,0 +1,152 @@
+#include <atomic>
+#include <vector>
+#include "accum.h"
+#include "fill.h"
+#include "links.h"
+#include "parallel.h"
+
+void flowAccumulation(const unsigned char* flowdir, const float* elev, float nodata, int xSize, int ySize,
+                      uint32_t* accum, int threads, const FlowLinks* links, bool wrapX, int tileSize)
+{
+    const size_t cells = (size_t)xSize * ySize;
+    const int xTiles = (xSize + tileSize - 1) / tileSize;
+    const int yTiles = (ySize + tileSize - 1) / tileSize;
+
+    // Flow direction code to neighbour index, -1 for outlets, pits and nodata
+    int down[256];
+    std::fill(down, down + 256, -1);
+    for (int d = 0; d < 8; d++)
+        down[ldd[d]] = d;
+
+    std::vector<std::atomic<uint32_t>> total(cells);
+    std::vector<std::atomic<unsigned char>> deps(cells);
+    std::vector<std::vector<size_t>> headwaters(xTiles * yTiles);
+
+    auto wrap = [&](int x){ return !wrapX ? x : x < 0 ? x + xSize : x >= xSize ? x - xSize : x; };
+
+    auto forTile = [&](size_t t, int& x0, int& y0, int& x1, int& y1)
+    {
+        x0 = (t % xTiles) * tileSize;
+        y0 = (t / xTiles) * tileSize;
+        x1 = std::min(x0 + tileSize, xSize);
+        y1 = std::min(y0 + tileSize, ySize);
+    };
+
+    // Count the upstream neighbours of every cell
+    parallelFor(threads, headwaters.size(), [&](size_t t)
+    {
+        int x0, y0, x1, y1;
+        forTile(t, x0, y0, x1, y1);
+        for (int y = y0; y < y1; y++)
+        {
+            for (int x = x0; x < x1; x++)
+            {
+                size_t c = (size_t)y * xSize + x;
+                unsigned char count = 0;
+                for (int d = 0; d < 8; d++)
+                {
+                    int nx = wrap(x + ngh[d].dx), ny = y + ngh[d].dy;
+                    if (nx >= 0 && nx < xSize && ny >= 0 && ny < ySize
+                        && down[flowdir[(size_t)ny * xSize + nx]] == (d + 4) % 8)
+                        count++;
+                }
+                if (links && links->linked(c) && flowdir[links->partner(c)] == linkFlow)
+                    count++;
+                deps[c].store(count, std::memory_order_relaxed);
+                total[c].store(elev[c] == nodata ? 0 : 1, std::memory_order_relaxed);
+                if (count == 0)
+                    headwaters[t].push_back(c);
+            }
+        }
+    });
+
+    // Walk downstream from the headwaters, handing each cell over to the
+    // thread that resolves its last dependency
+    parallelFor(threads, headwaters.size(), [&](size_t t)
+    {
+        for (size_t c : headwaters[t])
+        {
+            for (;;)
+            {
+                size_t n;
+                if (links && flowdir[c] == linkFlow && links->linked(c))
+                {
+                    n = links->partner(c);
+                }
+                else
+                {
+                    int d = down[flowdir[c]];
+                    if (d < 0)
+                        break;
+                    int x = wrap(c % xSize + ngh[d].dx), y = c / xSize + ngh[d].dy;
+                    if (x < 0 || x >= xSize || y < 0 || y >= ySize)
+                        break;
+                    n = (size_t)y * xSize + x;
+                }
+                total[n].fetch_add(total[c].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                if (deps[n].fetch_sub(1, std::memory_order_acq_rel) != 1)
+                    break;
+                c = n;
+            }
+        }
+    });
+
+    parallelFor(threads, ySize, [&](size_t y)
+    {
+        for (size_t c = y * xSize; c < (y + 1) * xSize; c++)
+            accum[c] = total[c].load(std::memory_order_relaxed);
+    });
+}
+
+size_t undrainedCells(const unsigned char* flowdir, int xSize, int ySize, const FlowLinks* links, bool wrapX)
+{
+    const size_t cells = (size_t)xSize * ySize;
+    int down[256];
+    std::fill(down, down + 256, -1);
+    for (int d = 0; d < 8; d++)
+        down[ldd[d]] = d;
+    auto wrap = [&](int x){ return !wrapX ? x : x < 0 ? x + xSize : x >= xSize ? x - xSize : x; };
+
+    // 1 on the path being followed, 2 drains, 3 does not
+    std::vector<unsigned char> state(cells, 0);
+    std::vector<size_t> path;
+    size_t undrained = 0;
+    for (size_t start = 0; start < cells; start++)
+    {
+        size_t c = start;
+        unsigned char result = 0;
+        while (!result)
+        {
+            if (state[c])
+            {
+                result = state[c] == 1 ? 3 : state[c];
+                break;
+            }
+            state[c] = 1;
+            path.push_back(c);
+            if (flowdir[c] == 255)
+            {
+                result = 2;
+            }
+            else if (links && flowdir[c] == linkFlow && links->linked(c))
+            {
+                c = links->partner(c);
+            }
+            else
+            {
+                int d = down[flowdir[c]];
+                int x = wrap(c % xSize + (d < 0 ? 0 : ngh[d].dx)), y = c / xSize + (d < 0 ? 0 : ngh[d].dy);
+                if (d < 0 || x < 0 || x >= xSize || y < 0 || y >= ySize)
+                    result = 3;
+                else
+                    c = (size_t)y * xSize + x;
+            }
+        }
+        for (size_t p : path)
+            state[p] = result;
+        if (result == 3)
+            undrained += path.size();
+        path.clear();
+    }
+    return undrained;
+}
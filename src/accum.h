@@ -0,0 +1,35 @@
+/***************************************************************
+#                   spillDEM flow accumulation                 #
+***************************************************************/
+
+#ifndef SPILLDEM_ACCUM_H
+#define SPILLDEM_ACCUM_H
+
+#include <cstddef>
+#include <cstdint>
+
+class FlowLinks;
+
+// Number of cells draining through every cell, itself included, following
+// the D8 flow directions written by the filling engines. Cells where elev
+// is nodata get 0.
+//
+// Parallel dependency counting (Wallis/Barnes 2017 style): the raster is
+// split in tiles, every cell counts the neighbours draining into it, then
+// each thread walks downstream from the headwaters of its tiles. The walk
+// continues into the downstream cell only when its last upstream
+// dependency is resolved, which an atomic decrement decides without locks.
+//
+// Cells with the linkFlow direction drain to their partner in links. With
+// wrapX, directions leaving the east or west edge enter the other one.
+void flowAccumulation(const unsigned char* flowdir, const float* elev, float nodata, int xSize, int ySize,
+                      uint32_t* accum, int threads, const FlowLinks* links = nullptr, bool wrapX = false,
+                      int tileSize = 512);
+
+// Number of cells whose flow path never reaches an outlet (255): it loops,
+// stops at a cell without a direction or leaves the raster. 0 for the flow
+// directions of every engine, which the benchmarks check after each run.
+size_t undrainedCells(const unsigned char* flowdir, int xSize, int ySize,
+                      const FlowLinks* links = nullptr, bool wrapX = false);
+
+#endif
@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include "baseline.h"
+
+std::vector<double>& EngineSamples::samples(const std::string& phase)
+{
+    for (PhaseSamples& p : phases)
+    {
+        if (p.name == phase)
+            return p.seconds;
+    }
+    phases.push_back(PhaseSamples());
+    phases.back().name = phase;
+    return phases.back().seconds;
+}
+
+const PhaseSamples* EngineSamples::find(const std::string& phase) const
+{
+    for (const PhaseSamples& p : phases)
+    {
+        if (p.name == phase)
+            return &p;
+    }
+    return nullptr;
+}
+
+const EngineSamples* Baseline::find(const std::string& engine) const
+{
+    for (const EngineSamples& e : engines)
+    {
+        if (e.engine == engine)
+            return &e;
+    }
+    return nullptr;
+}
+
+bool saveBaseline(const std::string& path, const Baseline& baseline)
+{
+    FILE* f = fopen(path.c_str(), "w");
+    if (f == nullptr)
+        return false;
+    fprintf(f, "{\n  \"version\": 1,\n  \"size\": %d,\n  \"repeat\": %d,\n  \"threads\": %d,\n  \"minslope\": %.9g,\n  \"tilesize\": %d,\n  \"engines\": {",
+            baseline.size, baseline.repeat, baseline.threads, baseline.minslope, baseline.tileSize);
+    for (size_t e = 0; e < baseline.engines.size(); e++)
+    {
+        const EngineSamples& engine = baseline.engines[e];
+        fprintf(f, "%s\n    \"%s\": {", e ? "," : "", engine.engine.c_str());
+        for (size_t p = 0; p < engine.phases.size(); p++)
+        {
+            fprintf(f, "%s\n      \"%s\": [", p ? "," : "", engine.phases[p].name.c_str());
+            for (size_t i = 0; i < engine.phases[p].seconds.size(); i++)
+                fprintf(f, "%s%.9g", i ? ", " : "", engine.phases[p].seconds[i]);
+            fprintf(f, "]");
+        }
+        fprintf(f, "\n    }");
+    }
+    fprintf(f, "\n  }\n}\n");
+    return fclose(f) == 0;
+}
+
+// Reader for the subset of JSON written by saveBaseline(): objects, arrays
+// of numbers, strings without escapes and numbers.
+class JsonReader
+{
+public:
+    JsonReader(const std::string& text) : text(text), pos(0) {}
+
+    bool expect(char c)
+    {
+        skip();
+        if (pos < text.size() && text[pos] == c)
+        {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    bool peek(char c)
+    {
+        skip();
+        return pos < text.size() && text[pos] == c;
+    }
+
+    bool string(std::string& out)
+    {
+        if (!expect('"'))
+            return false;
+        size_t end = text.find('"', pos);
+        if (end == std::string::npos)
+            return false;
+        out = text.substr(pos, end - pos);
+        pos = end + 1;
+        return true;
+    }
+
+    bool number(double& out)
+    {
+        skip();
+        const char* start = text.c_str() + pos;
+        char* end;
+        out = std::strtod(start, &end);
+        if (end == start)
+            return false;
+        pos += end - start;
+        return true;
+    }
+
+    bool numbers(std::vector<double>& out)
+    {
+        out.clear();
+        if (!expect('['))
+            return false;
+        if (expect(']'))
+            return true;
+        do
+        {
+            double v;
+            if (!number(v))
+                return false;
+            out.push_back(v);
+        } while (expect(','));
+        return expect(']');
+    }
+
+private:
+    void skip()
+    {
+        while (pos < text.size() && std::isspace((unsigned char)text[pos]))
+            pos++;
+    }
+
+    const std::string& text;
+    size_t pos;
+};
+
+bool loadBaseline(const std::string& path, Baseline& baseline)
+{
+    FILE* f = fopen(path.c_str(), "r");
+    if (f == nullptr)
+        return false;
+    std::string text;
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        text.append(buffer, n);
+    fclose(f);
+
+    JsonReader json(text);
+    baseline = Baseline();
+    if (!json.expect('{'))
+        return false;
+    do
+    {
+        std::string key;
+        double value;
+        if (!json.string(key) || !json.expect(':'))
+            return false;
+        if (key != "engines")
+        {
+            if (!json.number(value))
+                return false;
+            if (key == "version" && value != 1)
+                return false;
+            else if (key == "size")
+                baseline.size = (int)value;
+            else if (key == "repeat")
+                baseline.repeat = (int)value;
+            else if (key == "threads")
+                baseline.threads = (int)value;
+            else if (key == "minslope")
+                baseline.minslope = value;
+            else if (key == "tilesize")
+                baseline.tileSize = (int)value;
+            continue;
+        }
+        if (!json.expect('{'))
+            return false;
+        if (json.expect('}'))
+            continue;
+        do
+        {
+            EngineSamples engine;
+            if (!json.string(engine.engine) || !json.expect(':') || !json.expect('{'))
+                return false;
+            do
+            {
+                PhaseSamples phase;
+                if (!json.string(phase.name) || !json.expect(':') || !json.numbers(phase.seconds))
+                    return false;
+                engine.phases.push_back(phase);
+            } while (json.expect(','));
+            if (!json.expect('}'))
+                return false;
+            baseline.engines.push_back(engine);
+        } while (json.expect(','));
+        if (!json.expect('}'))
+            return false;
+    } while (json.expect(','));
+    return json.expect('}') && baseline.size > 0;
+}
+
+static void meanVariance(const std::vector<double>& x, double& mean, double& variance)
+{
+    mean = 0.0;
+    for (double v : x)
+        mean += v;
+    mean /= x.size();
+    variance = 0.0;
+    for (double v : x)
+        variance += (v - mean) * (v - mean);
+    variance = x.size() > 1 ? variance / (x.size() - 1) : 0.0;
+}
+
+// Exact two sided Student t quantiles for 1 to 30 degrees of freedom
+static const int tableDf = 30;
+static const double t95[tableDf] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+static const double t99[tableDf] = {
+    63.657, 9.925, 5.841, 4.604, 4.032, 3.707, 3.499, 3.355, 3.250, 3.169,
+    3.106, 3.055, 3.012, 2.977, 2.947, 2.921, 2.898, 2.878, 2.861, 2.845,
+    2.831, 2.819, 2.807, 2.797, 2.787, 2.779, 2.771, 2.763, 2.756, 2.750 };
+
+// Two sided Student t quantile at a confidence level of 0.95 or 0.99. Up
+// to 30 degrees of freedom from the table, linear in 1 / df between its
+// entries since Welch degrees of freedom are not integers, above from the
+// normal quantile with the Cornish-Fisher expansion, within 0.01% there.
+static double studentQuantile(bool high, double df)
+{
+    const double* table = high ? t99 : t95;
+    if (df < tableDf)
+    {
+        int k = std::max(1, (int)df);
+        if (k == df)
+            return table[k - 1];
+        double w = (1.0 / k - 1.0 / df) / (1.0 / k - 1.0 / (k + 1));
+        return table[k - 1] + w * (table[k] - table[k - 1]);
+    }
+    double z = high ? 2.5758293 : 1.9599640;
+    double z3 = z * z * z, z5 = z3 * z * z, z7 = z5 * z * z;
+    return z + (z3 + z) / (4 * df) + (5 * z5 + 16 * z3 + 3 * z) / (96 * df * df)
+             + (3 * z7 + 19 * z5 + 17 * z3 - 15 * z) / (384 * df * df * df);
+}
+
+bool compareSamples(const std::vector<double>& base, const std::vector<double>& current, Delta& d,
+                    double confidence)
+{
+    if (confidence != 0.95 && confidence != 0.99)
+        return false;
+
+    double m0, v0, m1, v1;
+    meanVariance(base, m0, v0);
+    meanVariance(current, m1, v1);
+    double s0 = v0 / base.size(), s1 = v1 / current.size();
+    double se = std::sqrt(s0 + s1);
+    // Welch-Satterthwaite degrees of freedom
+    double df = (s0 + s1) * (s0 + s1);
+    double den = 0.0;
+    if (base.size() > 1)
+        den += s0 * s0 / (base.size() - 1);
+    if (current.size() > 1)
+        den += s1 * s1 / (current.size() - 1);
+    df = den > 0.0 ? std::max(1.0, df / den) : 1e6;
+    double margin = studentQuantile(confidence == 0.99, df) * se;
+
+    d.baseMean = m0;
+    d.currentMean = m1;
+    d.change = 100.0 * (m1 - m0) / m0;
+    d.low = 100.0 * (m1 - m0 - margin) / m0;
+    d.high = 100.0 * (m1 - m0 + margin) / m0;
+    return true;
+}
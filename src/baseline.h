@@ -0,0 +1,62 @@
+/***************************************************************
+#                  spillDEM benchmark baselines                #
+****************************************************************
+#                                                              #
+#     Saved benchmark samples, and their comparison against    #
+#   a new run to detect performance regressions.               #
+#                                                              #
+***************************************************************/
+
+#ifndef SPILLDEM_BASELINE_H
+#define SPILLDEM_BASELINE_H
+
+#include <string>
+#include <vector>
+
+struct PhaseSamples
+{
+    std::string name;             // "total" or the name of an engine phase
+    std::vector<double> seconds;  // one sample per run
+};
+
+struct EngineSamples
+{
+    std::string engine;
+    std::vector<PhaseSamples> phases;
+
+    std::vector<double>& samples(const std::string& phase);
+    const PhaseSamples* find(const std::string& phase) const;
+};
+
+struct Baseline
+{
+    int size = 0;
+    int repeat = 0;
+    int threads = 1;
+    double minslope = 0.0;
+    int tileSize = 1024;
+    std::vector<EngineSamples> engines;
+
+    const EngineSamples* find(const std::string& engine) const;
+};
+
+bool saveBaseline(const std::string& path, const Baseline& baseline);
+bool loadBaseline(const std::string& path, Baseline& baseline);
+
+// Relative change of the mean run time between two sets of samples, with
+// its confidence interval. All values are in percent of the baseline mean.
+struct Delta
+{
+    double baseMean;
+    double currentMean;
+    double change;
+    double low;
+    double high;
+};
+
+// Welch interval on the difference of the means, at the given two sided
+// confidence level. Fails for levels other than 0.95 and 0.99.
+bool compareSamples(const std::vector<double>& base, const std::vector<double>& current, Delta& delta,
+                    double confidence = 0.95);
+
+#endif
@@ -0,0 +1,328 @@
+/***************************************************************
+#                  spillDEM watershed partitioned engine       #
+****************************************************************
+#                                                              #
+#     Parallel flood over partitions that follow the drainage  #
+#   divides instead of a fixed tile grid. A coarse DEM made    #
+#   of block minima is filled and its flow directions traced   #
+#   to the outlets, giving the major basins. Every basin is    #
+#   then flooded on its own, in parallel and largest first,    #
+#   from its own outlets only, so that the other basins are    #
+#   walls. Where a coarse divide misses the real one, a        #
+#   depression spills into a neighbouring basin: a final       #
+#   serial priority flood seeded across the basin boundaries   #
+#   lowers the cells concerned, and only those. Flat filling   #
+#   only.                                                      #
+#                                                              #
+***************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <queue>
+#include "fill.h"
+#include "parallel.h"
+
+// The coarse DEM has at most this many cells per side
+static const int coarseSide = 512;
+// and its blocks at least this side
+static const int minBlockSide = 8;
+
+namespace
+{
+// Lowers cell n to spill, draining to its neighbour from
+struct lowering
+{
+    float spill;
+    size_t n;
+    int from;
+
+    bool operator<(const lowering& rhs) const
+    {
+        return spill > rhs.spill;
+    }
+};
+}
+
+void fillWatershedPartitioned(float* elev, unsigned char* flowdir, int xSize, int ySize,
+                              const FillParams& params, FillStats* stats)
+{
+    Timer timer;
+    const float nodata = params.nodata;
+    const size_t cells = (size_t)xSize * ySize;
+    float pixelSizeX = std::fabs(params.pixelSizeX), pixelSizeY = std::fabs(params.pixelSizeY);
+    float diaglength = std::sqrt(pixelSizeX * pixelSizeX + pixelSizeY * pixelSizeY);
+    std::array<float, 8> length = { pixelSizeX, diaglength, pixelSizeY,
+                                    diaglength, pixelSizeX, diaglength,
+                                    pixelSizeY, diaglength};
+
+    auto isInBounds = [&](int x, int y){ return x >= 0 && x < xSize && y >= 0 && y < ySize; };
+
+    // Coarse DEM of the block minima, nodata for blocks without data
+    const int block = std::max(minBlockSide, (std::max(xSize, ySize) + coarseSide - 1) / coarseSide);
+    const int cx = (xSize + block - 1) / block, cy = (ySize + block - 1) / block;
+    std::vector<float> coarse((size_t)cx * cy, nodata);
+    std::vector<unsigned char> coarseFlow(coarse.size());
+    parallelFor(params.threads, cy, [&](size_t by)
+    {
+        for (int y = by * block; y < std::min(ySize, (int)(by + 1) * block); y++)
+        {
+            for (int x = 0; x < xSize; x++)
+            {
+                float& z = coarse[by * cx + x / block];
+                float e = elev[(size_t)y * xSize + x];
+                if (e != nodata && (z == nodata || e < z))
+                    z = e;
+            }
+        }
+    });
+    FillParams coarseParams = params;
+    coarseParams.minslope = 0.0f;
+    coarseParams.pixelSizeX *= block;
+    coarseParams.pixelSizeY *= block;
+    coarseParams.trace = nullptr;
+    coarseParams.links = nullptr;
+    fillPriorityFlood(coarse.data(), coarseFlow.data(), cx, cy, coarseParams);
+
+    // Basin of every block: the outlet its coarse flow path ends at
+    std::array<int, 10> codeDir;
+    codeDir.fill(-1);
+    for (int d = 0; d < 8; d++)
+        codeDir[ldd[d]] = d;
+    std::vector<int> basinOf(coarse.size(), -1);
+    int basins = 0;
+    std::vector<size_t> path;
+    for (size_t b = 0; b < coarse.size(); b++)
+    {
+        size_t c = b;
+        while (basinOf[c] < 0)
+        {
+            path.push_back(c);
+            unsigned char code = coarseFlow[c];
+            if (code > 9 || codeDir[code] < 0)
+            {
+                basinOf[c] = basins++;
+                break;
+            }
+            int d = codeDir[code];
+            c = (c / cx + ngh[d].dy) * cx + c % cx + ngh[d].dx;
+        }
+        for (size_t p : path)
+            basinOf[p] = basinOf[c];
+        path.clear();
+    }
+
+    // Blocks of every basin, largest basins first so that they start first
+    std::vector<size_t> area(basins, 0), first(basins + 1, 0);
+    for (size_t b = 0; b < coarse.size(); b++)
+    {
+        area[basinOf[b]] += (size_t)std::min(block, xSize - (int)(b % cx) * block)
+                          * std::min(block, ySize - (int)(b / cx) * block);
+        first[basinOf[b] + 1]++;
+    }
+    for (int p = 0; p < basins; p++)
+        first[p + 1] += first[p];
+    std::vector<size_t> blocks(coarse.size());
+    std::vector<size_t> fill(first.begin(), first.end() - 1);
+    for (size_t b = 0; b < coarse.size(); b++)
+        blocks[fill[basinOf[b]]++] = b;
+    std::vector<int> order(basins);
+    for (int p = 0; p < basins; p++)
+        order[p] = p;
+    std::sort(order.begin(), order.end(), [&](int a, int b){ return area[a] > area[b]; });
+    auto basinAt = [&](int x, int y){ return basinOf[(size_t)(y / block) * cx + x / block]; };
+    std::vector<float>().swap(coarse);
+    std::vector<unsigned char>().swap(coarseFlow);
+    if (stats)
+        stats->addPhase("coarse", timer.lap());
+
+    // Spill elevations, infinite for the cells their own basin cannot drain.
+    // The DEM is kept as it is for the final pass.
+    std::vector<float> spill(cells, INFINITY);
+    std::vector<unsigned char> state(cells, 0); // 1 queued, 2 processed
+    std::atomic<size_t> pushes(0), pops(0);
+    parallelFor(params.threads, basins, [&](size_t i)
+    {
+        const int p = order[i];
+        std::priority_queue<node> queue;
+        std::queue<node> flat;
+        size_t basinPushes = 0, basinPops = 0;
+
+        for (size_t k = first[p]; k < first[p + 1]; k++)
+        {
+            int bx = blocks[k] % cx * block, by = blocks[k] / cx * block;
+            for (int y = by; y < std::min(ySize, by + block); y++)
+            {
+                for (int x = bx; x < std::min(xSize, bx + block); x++)
+                {
+                    size_t c = (size_t)y * xSize + x;
+                    if (elev[c] == nodata)
+                    {
+                        spill[c] = nodata;
+                        flowdir[c] = 255;
+                        state[c] = 2;
+                        continue;
+                    }
+                    for (int d = 0; d < 8; d++)
+                    {
+                        int nx = x + ngh[d].dx, ny = y + ngh[d].dy;
+                        if (!isInBounds(nx, ny) || elev[(size_t)ny * xSize + nx] == nodata)
+                        {
+                            spill[c] = elev[c];
+                            flowdir[c] = 255;
+                            state[c] = 1;
+                            queue.push(node(elev[c], x, y));
+                            basinPushes++;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        while (!flat.empty() || !queue.empty())
+        {
+            node current(0.0f, 0, 0);
+            if (!flat.empty())
+            {
+                current = flat.front();
+                flat.pop();
+            }
+            else
+            {
+                current = queue.top();
+                queue.pop();
+            }
+            basinPops++;
+            size_t c = (size_t)current.y * xSize + current.x;
+            float z = current.spill;
+            float maxgrad = -1.0f;
+            int dmax = 8;
+            // Away from its block perimeter, all neighbours share the block
+            const int lx = current.x % block, ly = current.y % block;
+            const bool inner = lx > 0 && lx < block - 1 && ly > 0 && ly < block - 1;
+            for (int d = 0; d < 8; d++)
+            {
+                int nx = current.x + ngh[d].dx, ny = current.y + ngh[d].dy;
+                if (!isInBounds(nx, ny) || (!inner && basinAt(nx, ny) != p))
+                    continue;
+                size_t n = (size_t)ny * xSize + nx;
+                if (state[n] == 0)
+                {
+                    state[n] = 1;
+                    if (elev[n] <= z)
+                    {
+                        spill[n] = z;
+                        flowdir[n] = ldd[(d + 4) % 8];
+                        flat.push(node(z, nx, ny));
+                    }
+                    else
+                    {
+                        spill[n] = elev[n];
+                        flowdir[n] = 0;
+                        queue.push(node(elev[n], nx, ny));
+                    }
+                    basinPushes++;
+                }
+                else if (state[n] == 2 && spill[n] <= z && (z - spill[n]) / length[d] > maxgrad)
+                {
+                    maxgrad = (z - spill[n]) / length[d];
+                    dmax = d;
+                }
+            }
+            if (!flowdir[c]) // Record the steepest gradient direction if needed
+                flowdir[c] = ldd[dmax];
+            state[c] = 2;
+        }
+        pushes += basinPushes;
+        pops += basinPops;
+    });
+    if (stats)
+        stats->addPhase("basins", timer.lap());
+
+    // Depressions spilling across a basin boundary: lower the cells next to
+    // a boundary that a neighbour across it drains lower, then whatever they
+    // drain in turn. Cells are lowered when popped, in increasing order, so
+    // every cell is lowered once and drains to a cell already final.
+    // Only the perimeters of the blocks touching another basin are scanned
+    std::vector<std::vector<lowering>> rowSeeds(cy);
+    parallelFor(params.threads, cy, [&](size_t by)
+    {
+        for (int bx = 0; bx < cx; bx++)
+        {
+            const int p = basinOf[by * cx + bx];
+            bool boundary = false;
+            for (int d = 0; d < 8 && !boundary; d++)
+            {
+                int nbx = bx + ngh[d].dx, nby = (int)by + ngh[d].dy;
+                boundary = nbx >= 0 && nbx < cx && nby >= 0 && nby < cy && basinOf[(size_t)nby * cx + nbx] != p;
+            }
+            if (!boundary)
+                continue;
+            const int x0 = bx * block, y0 = by * block;
+            const int w = std::min(block, xSize - x0), h = std::min(block, ySize - y0);
+            for (int ly = 0; ly < h; ly++)
+            {
+                for (int lx = 0; lx < w; lx += (ly == 0 || ly == h - 1) ? 1 : std::max(1, w - 1))
+                {
+                    int x = x0 + lx, y = y0 + ly;
+                    size_t c = (size_t)y * xSize + x;
+                    if (elev[c] == nodata)
+                        continue;
+                    for (int d = 0; d < 8; d++)
+                    {
+                        int nx = x + ngh[d].dx, ny = y + ngh[d].dy;
+                        if (!isInBounds(nx, ny) || basinAt(nx, ny) == p)
+                            continue;
+                        size_t n = (size_t)ny * xSize + nx;
+                        float z = std::max(elev[c], spill[n]);
+                        if (elev[n] != nodata && z < spill[c])
+                            rowSeeds[by].push_back({z, c, d});
+                    }
+                }
+            }
+        }
+    });
+    std::priority_queue<lowering> queue;
+    for (std::vector<lowering>& seeds : rowSeeds)
+    {
+        for (const lowering& l : seeds)
+            queue.push(l);
+        std::vector<lowering>().swap(seeds);
+    }
+    pushes += queue.size();
+    while (!queue.empty())
+    {
+        lowering current = queue.top();
+        queue.pop();
+        pops++;
+        if (current.spill >= spill[current.n])
+            continue;
+        spill[current.n] = current.spill;
+        flowdir[current.n] = ldd[current.from];
+        int x = current.n % xSize, y = current.n / xSize;
+        for (int d = 0; d < 8; d++)
+        {
+            int nx = x + ngh[d].dx, ny = y + ngh[d].dy;
+            if (!isInBounds(nx, ny))
+                continue;
+            size_t n = (size_t)ny * xSize + nx;
+            float z = std::max(elev[n], current.spill);
+            if (elev[n] != nodata && z < spill[n])
+            {
+                queue.push({z, n, (d + 4) % 8});
+                pushes++;
+            }
+        }
+    }
+    parallelFor(params.threads, ySize, [&](size_t y)
+    {
+        std::copy(spill.begin() + y * xSize, spill.begin() + (y + 1) * xSize, elev + y * xSize);
+    });
+    if (stats)
+    {
+        stats->addPhase("boundaries", timer.lap());
+        stats->pushes += pushes;
+        stats->pops += pops;
+    }
+}
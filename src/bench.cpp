@@ -0,0 +1,518 @@
+/***************************************************************
+#                      spillDEM benchmarks                     #
+****************************************************************
+#                                                              #
+#     Benchmark driver for the filling engines. Runs on        #
+#   generated DEMs so that results do not depend on the        #
+#   input data or on the storage the DEMs are read from.       #
+#                                                              #
+***************************************************************/
+
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "SpillDEM.h" // config file
+#include "accum.h"
+#include "baseline.h"
+#include "fill.h"
+#include "queues.h"
+#include "synthetic.h"
+#include "sysinfo.h"
+#include "trace.h"
+
+static void usage(const char* name)
+{
+    printf("%s version %d.%d\n"
+           "usage: %s <mode> <options>\n"
+           "Modes:\n"
+            "\t-s, --scaling       strong (thread count) and weak (raster size) scaling sweeps\n"
+            "\t-R, --replay FILE   replay a queue trace recorded with spilldem --trace against every queue\n"
+            "\t-S, --save FILE     run every engine and save the timings as a JSON baseline\n"
+            "\t-C, --compare FILE  run with the settings of a saved baseline and report the changes,\n"
+            "\t                    exits with an error status when an engine or phase regressed\n"
+            "Options:\n"
+            "\t-o, --output        CSV output file (default scaling.csv)\n"
+            "\t-e, --engine        only benchmark this engine (default: all engines)\n"
+            "\t-t, --threads       comma separated thread counts (default 1,2,4,... up to the available CPUs)\n"
+            "\t-n, --size          raster side for the strong sweep and 1-thread side for the weak sweep (default 2048)\n"
+            "\t-r, --repeat        runs per configuration, the median is reported (default 3, 10 for baselines)\n"
+            "\t-x, --threshold     slowdown in percent reported as a regression by --compare (default 5)\n"
+            "\t-m, --minslope      minimum preserved slope gradient\n"
+            "\t-z, --tile-size     tile side of the tiled engines (default 1024)\n"
+            "\n"
+            "\t-h, --help          display this message and exit\n",
+            name, SpillDEM_VERSION_MAJOR, SpillDEM_VERSION_MINOR, name);
+}
+
+static std::vector<int> parseList(const char* arg)
+{
+    std::vector<int> values;
+    char* end;
+    while (*arg)
+    {
+        long v = std::strtol(arg, &end, 10);
+        if (end == arg || v <= 0)
+            return std::vector<int>();
+        values.push_back((int)v);
+        arg = (*end == ',') ? end + 1 : end;
+    }
+    return values;
+}
+
+struct sample
+{
+    double seconds;
+    long maxrss; // peak resident set size of the run, in kB
+    FillStats stats;
+};
+
+// Run one fill in a forked child so that the peak RSS reported by wait4()
+// belongs to that run alone.
+static bool runIsolated(const engine& e, int xSize, int ySize, const FillParams& params, sample& out)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+    pid_t pid = fork();
+    if (pid < 0)
+        return false;
+    if (pid == 0)
+    {
+        close(fds[0]);
+        std::vector<float> elev((size_t)xSize * ySize);
+        std::vector<unsigned char> flowdir((size_t)xSize * ySize);
+        generateDEM(elev.data(), xSize, ySize, 42);
+        FillStats stats;
+        Timer timer;
+        e.fill(elev.data(), flowdir.data(), xSize, ySize, params, &stats);
+        double seconds = timer.lap();
+        // Not timed: a run whose flow paths loop or stop failed
+        size_t undrained = undrainedCells(flowdir.data(), xSize, ySize);
+        if (undrained)
+        {
+            fprintf(stderr, "Error: %zu cells of the %s engine do not drain to an outlet\n", undrained, e.name);
+            _exit(EXIT_FAILURE);
+        }
+        FILE* f = fdopen(fds[1], "w");
+        fprintf(f, "total %.9f\n", seconds);
+        for (const auto& phase : stats.phases)
+            fprintf(f, "phase %s %.9f\n", phase.first.c_str(), phase.second);
+        fprintf(f, "ops %zu %zu\n", stats.pushes, stats.pops);
+        fclose(f);
+        _exit(EXIT_SUCCESS);
+    }
+    close(fds[1]);
+    FILE* f = fdopen(fds[0], "r");
+    bool ok = false;
+    char key[32], name[64];
+    double seconds;
+    out.stats = FillStats();
+    while (fscanf(f, "%31s", key) == 1)
+    {
+        if (!strcmp(key, "total") && fscanf(f, "%lf", &out.seconds) == 1)
+            ok = true;
+        else if (!strcmp(key, "phase") && fscanf(f, "%63s %lf", name, &seconds) == 2)
+            out.stats.addPhase(name, seconds);
+        else if (!strcmp(key, "ops"))
+            ok = ok && fscanf(f, "%zu %zu", &out.stats.pushes, &out.stats.pops) == 2;
+    }
+    fclose(f);
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+        return false;
+    out.maxrss = usage.ru_maxrss;
+    return ok;
+}
+
+// Median time and largest peak RSS over repeated runs
+static bool measure(const engine& e, int side, const FillParams& params, int repeat, sample& out)
+{
+    std::vector<double> times;
+    out.maxrss = 0;
+    for (int r = 0; r < repeat; r++)
+    {
+        sample s;
+        if (!runIsolated(e, side, side, params, s))
+            return false;
+        times.push_back(s.seconds);
+        out.maxrss = std::max(out.maxrss, s.maxrss);
+    }
+    std::sort(times.begin(), times.end());
+    out.seconds = times[times.size() / 2];
+    return true;
+}
+
+// Engines without gradient preservation are skipped when a minimum slope is asked for
+static bool supported(const engine& e, const FillParams& params)
+{
+    if (e.gradient || params.minslope <= 0.0f)
+        return true;
+    fprintf(stderr, "Skipping engine %s, it only supports --minslope 0\n", e.name);
+    return false;
+}
+
+static int runScaling(FILE* csv, const std::vector<const engine*>& engines, const std::vector<int>& threads,
+                      int size, int repeat, FillParams params, bool verbose)
+{
+    fprintf(csv, "study,engine,threads,xsize,ysize,cells,seconds,cells_per_sec,peak_rss_kb\n");
+    for (int study = 0; study < 2; study++)
+    {
+        const char* name = study == 0 ? "strong" : "weak";
+        for (const engine* e : engines)
+        {
+            if (!supported(*e, params))
+                continue;
+            for (int t : threads)
+            {
+                // Serial engines only contribute one point to the strong sweep
+                if (!e->parallel && study == 0 && t != threads.front())
+                    continue;
+                // Weak scaling keeps the number of cells per thread constant
+                int side = study == 0 ? size : int(std::lround(size * std::sqrt(double(t))));
+                params.threads = e->parallel ? t : 1;
+                sample s;
+                if (!measure(*e, side, params, repeat, s))
+                {
+                    fprintf(stderr, "Error: %s run failed (engine %s, %d threads, %dx%d)\n", name, e->name, t, side, side);
+                    return EXIT_FAILURE;
+                }
+                double cells = double(side) * side;
+                fprintf(csv, "%s,%s,%d,%d,%d,%.0f,%.6f,%.0f,%ld\n", name, e->name, params.threads,
+                        side, side, cells, s.seconds, cells / s.seconds, s.maxrss);
+                fflush(csv);
+                if (verbose)
+                    printf("%-6s %-8s %3d threads %6dx%-6d %10.0f cells/s %8ld kB\n", name, e->name,
+                           params.threads, side, side, cells / s.seconds, s.maxrss);
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+static bool runBaseline(const std::vector<const engine*>& engines, const FillParams& params,
+                        int size, int repeat, Baseline& baseline)
+{
+    baseline.size = size;
+    baseline.repeat = repeat;
+    baseline.threads = params.threads;
+    baseline.minslope = params.minslope;
+    baseline.tileSize = params.tileSize;
+    for (const engine* e : engines)
+    {
+        if (!supported(*e, params))
+            continue;
+        EngineSamples samples;
+        samples.engine = e->name;
+        for (int r = 0; r < repeat; r++)
+        {
+            sample s;
+            if (!runIsolated(*e, size, size, params, s))
+            {
+                fprintf(stderr, "Error: run failed (engine %s)\n", e->name);
+                return false;
+            }
+            samples.samples("total").push_back(s.seconds);
+            for (const auto& phase : s.stats.phases)
+                samples.samples(phase.first).push_back(phase.second);
+        }
+        baseline.engines.push_back(samples);
+    }
+    return true;
+}
+
+// Print the change of every engine and phase against the baseline and
+// return the number of regressions, i.e. significant slowdowns larger than
+// the threshold.
+static int compareBaseline(const Baseline& base, const Baseline& current, double threshold)
+{
+    int regressions = 0;
+    printf("%-10s %-10s %11s %11s %9s %21s\n", "engine", "phase", "baseline", "current", "change", "95% interval");
+    for (const EngineSamples& engine : current.engines)
+    {
+        const EngineSamples* reference = base.find(engine.engine);
+        if (reference == nullptr)
+        {
+            printf("%-10s %-10s not in baseline\n", engine.engine.c_str(), "");
+            continue;
+        }
+        for (const PhaseSamples& phase : engine.phases)
+        {
+            const PhaseSamples* samples = reference->find(phase.name);
+            if (samples == nullptr || samples->seconds.empty())
+            {
+                printf("%-10s %-10s not in baseline\n", engine.engine.c_str(), phase.name.c_str());
+                continue;
+            }
+            Delta d;
+            compareSamples(samples->seconds, phase.seconds, d);
+            bool regressed = d.change > threshold && d.low > 0.0;
+            regressions += regressed;
+            printf("%-10s %-10s %10.4fs %10.4fs %+8.1f%% [%+8.1f%%, %+8.1f%%]%s\n", engine.engine.c_str(),
+                   phase.name.c_str(), d.baseMean, d.currentMean, d.change, d.low, d.high,
+                   regressed ? "  REGRESSION" : "");
+        }
+    }
+    for (const EngineSamples& engine : base.engines)
+    {
+        if (current.find(engine.engine) == nullptr)
+            printf("%-10s %-10s not benchmarked\n", engine.engine.c_str(), "");
+    }
+    return regressions;
+}
+
+// Replay the recorded operations against one queue implementation. The
+// popped spill elevations are summed so the pops cannot be optimised away.
+template <class Queue>
+static double replay(const std::vector<node>& ops, double& checksum)
+{
+    Queue queue;
+    Timer timer;
+    for (const node& op : ops)
+    {
+        if (op.x < 0)
+        {
+            checksum += queue.top().spill;
+            queue.pop();
+        }
+        else
+        {
+            queue.push(op);
+        }
+    }
+    return timer.lap();
+}
+
+static double replayWith(QueueKind kind, const std::vector<node>& ops, double& checksum)
+{
+    switch (kind)
+    {
+    case QueueKind::Binary:
+        return replay<std::priority_queue<node>>(ops, checksum);
+    case QueueKind::Quaternary:
+        return replay<DaryHeap<node, 4>>(ops, checksum);
+    }
+    return 0.0;
+}
+
+static int runReplay(const std::string& tracefile, int repeat)
+{
+    int xSize, ySize;
+    std::vector<node> ops;
+    if (!readQueueTrace(tracefile, xSize, ySize, ops))
+    {
+        fprintf(stderr, "Error: Cannot read queue trace %s\n", tracefile.c_str());
+        return EXIT_FAILURE;
+    }
+    size_t pops = 0;
+    for (const node& op : ops)
+        pops += op.x < 0;
+    printf("%s: %dx%d raster, %zu pushes, %zu pops\n", tracefile.c_str(), xSize, ySize, ops.size() - pops, pops);
+    printf("%-12s %12s %12s\n", "queue", "seconds", "Mops/s");
+    for (QueueKind kind : queueKinds())
+    {
+        std::vector<double> times;
+        double checksum = 0.0;
+        for (int r = 0; r < repeat; r++)
+            times.push_back(replayWith(kind, ops, checksum));
+        std::sort(times.begin(), times.end());
+        double seconds = times[times.size() / 2];
+        printf("%-12s %12.6f %12.2f\n", queueKindName(kind), seconds, ops.size() / seconds * 1e-6);
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+    const option long_opts[] =
+    {
+        {"scaling", no_argument, nullptr, 's'},
+        {"replay", required_argument, nullptr, 'R'},
+        {"save", required_argument, nullptr, 'S'},
+        {"compare", required_argument, nullptr, 'C'},
+        {"threshold", required_argument, nullptr, 'x'},
+        {"output", required_argument, nullptr, 'o'},
+        {"engine", required_argument, nullptr, 'e'},
+        {"threads", required_argument, nullptr, 't'},
+        {"size", required_argument, nullptr, 'n'},
+        {"repeat", required_argument, nullptr, 'r'},
+        {"minslope", required_argument, nullptr, 'm'},
+        {"tile-size", required_argument, nullptr, 'z'},
+        {"verbose", no_argument, nullptr, 'v'},
+        {"help", no_argument, nullptr, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    bool scaling = false, verbose = false;
+    std::string outfile = "scaling.csv";
+    std::string engineName = "";
+    std::string tracefile = "";
+    std::string savefile = "", comparefile = "";
+    double threshold = 5.0;
+    std::vector<int> threads;
+    int size = 2048, repeat = 0;
+    FillParams params;
+    while ((opt = getopt_long(argc, argv, ":sR:S:C:x:o:e:t:n:r:m:z:vh", long_opts, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            scaling = true;
+            break;
+        case 'R':
+            tracefile = std::string(optarg);
+            break;
+        case 'S':
+            savefile = std::string(optarg);
+            break;
+        case 'C':
+            comparefile = std::string(optarg);
+            break;
+        case 'x':
+            threshold = std::atof(optarg);
+            break;
+        case 'o':
+            outfile = std::string(optarg);
+            break;
+        case 'e':
+            engineName = std::string(optarg);
+            break;
+        case 't':
+            threads = parseList(optarg);
+            if (threads.empty())
+            {
+                fprintf(stderr, "Error: Invalid thread list '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'n':
+            size = std::atoi(optarg);
+            break;
+        case 'r':
+            repeat = std::max(1, std::atoi(optarg));
+            break;
+        case 'm':
+            params.minslope = std::atof(optarg);
+            break;
+        case 'z':
+            params.tileSize = std::max(3, std::atoi(optarg));
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+            break;
+        case '?':
+            usage(argv[0]);
+            fprintf(stderr, "Error: Unknown option -%c\n", (char)optopt);
+            exit(EXIT_FAILURE);
+            break;
+        case ':':
+            usage(argv[0]);
+            fprintf(stderr, "Error: Option -%c requires an argument\n", (char)optopt);
+            exit(EXIT_FAILURE);
+            break;
+        }
+    }
+
+    const bool baselines = !savefile.empty() || !comparefile.empty();
+    if (repeat == 0)
+        repeat = baselines ? 10 : 3;
+    if (!tracefile.empty())
+    {
+        exit(runReplay(tracefile, repeat));
+    }
+    if (!scaling && !baselines)
+    {
+        usage(argv[0]);
+        fprintf(stderr, "Error: No benchmark mode specified.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (size <= 0)
+    {
+        fprintf(stderr, "Error: Invalid raster size %d\n", size);
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<const engine*> engines;
+    for (const engine& e : fillEngines())
+    {
+        if (engineName.empty() || engineName == e.name)
+            engines.push_back(&e);
+    }
+    if (engines.empty())
+    {
+        fprintf(stderr, "Error: Unknown engine '%s'\n", engineName.c_str());
+        exit(EXIT_FAILURE);
+    }
+    if (threads.empty())
+    {
+        int cores = availableCpus();
+        for (int t = 1; t < cores; t *= 2)
+            threads.push_back(t);
+        threads.push_back(cores);
+    }
+
+    if (baselines)
+    {
+        Baseline reference, current;
+        if (!comparefile.empty())
+        {
+            if (!loadBaseline(comparefile, reference))
+            {
+                fprintf(stderr, "Error: Cannot read baseline %s\n", comparefile.c_str());
+                exit(EXIT_FAILURE);
+            }
+            // Always measure with the settings the baseline was taken with
+            size = reference.size;
+            repeat = reference.repeat;
+            params.threads = reference.threads;
+            params.minslope = reference.minslope;
+            params.tileSize = reference.tileSize;
+        }
+        else
+        {
+            params.threads = threads.back();
+        }
+        if (!runBaseline(engines, params, size, repeat, current))
+            exit(EXIT_FAILURE);
+        if (!savefile.empty() && !saveBaseline(savefile, current))
+        {
+            fprintf(stderr, "Error: Cannot write baseline %s\n", savefile.c_str());
+            exit(EXIT_FAILURE);
+        }
+        if (!comparefile.empty())
+        {
+            int regressions = compareBaseline(reference, current, threshold);
+            if (regressions > 0)
+            {
+                fprintf(stderr, "Error: %d regression(s) above %.1f%%\n", regressions, threshold);
+                exit(EXIT_FAILURE);
+            }
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    FILE* csv = fopen(outfile.c_str(), "w");
+    if (csv == nullptr)
+    {
+        fprintf(stderr, "Error: Cannot open %s for writing\n", outfile.c_str());
+        exit(EXIT_FAILURE);
+    }
+    int status = runScaling(csv, engines, threads, size, repeat, params, verbose);
+    fclose(csv);
+    exit(status);
+}
@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <cstring>
+#include "blocks.h"
+
+BlockWriter::BlockWriter(int xSize, int ySize, int blockXSize, int blockYSize, size_t cellBytes, Flush flush)
+    : xSize(xSize), ySize(ySize), blockXSize(std::max(1, blockXSize)), blockYSize(std::max(1, blockYSize)),
+      cellBytes(cellBytes), flush(flush)
+{
+    xBlocks = (xSize + this->blockXSize - 1) / this->blockXSize;
+    writer = std::thread(&BlockWriter::run, this);
+}
+
+BlockWriter::~BlockWriter()
+{
+    finish();
+}
+
+void BlockWriter::window(size_t b, int& x0, int& y0, int& w, int& h) const
+{
+    x0 = (int)(b % xBlocks) * blockXSize;
+    y0 = (int)(b / xBlocks) * blockYSize;
+    w = std::min(blockXSize, xSize - x0);
+    h = std::min(blockYSize, ySize - y0);
+}
+
+void BlockWriter::write(int x0, int y0, int w, int h, const void* data)
+{
+    const char* src = (const char*)data;
+    std::lock_guard<std::mutex> guard(lock);
+    for (int by = y0 / blockYSize; by * blockYSize < y0 + h; by++)
+    {
+        for (int bx = x0 / blockXSize; bx * blockXSize < x0 + w; bx++)
+        {
+            size_t b = (size_t)by * xBlocks + bx;
+            int bx0, by0, bw, bh;
+            window(b, bx0, by0, bw, bh);
+            auto it = pending.find(b);
+            if (it == pending.end())
+            {
+                Block block;
+                block.data.resize((size_t)bw * bh * cellBytes);
+                block.missing = (size_t)bw * bh;
+                held += block.data.size();
+                peak = std::max(peak, held);
+                it = pending.emplace(b, std::move(block)).first;
+            }
+
+            // Intersection of the window and the block
+            int ix0 = std::max(x0, bx0), ix1 = std::min(x0 + w, bx0 + bw);
+            int iy0 = std::max(y0, by0), iy1 = std::min(y0 + h, by0 + bh);
+            size_t rowBytes = (size_t)(ix1 - ix0) * cellBytes;
+            for (int y = iy0; y < iy1; y++)
+            {
+                std::memcpy(it->second.data.data() + ((size_t)(y - by0) * bw + (ix0 - bx0)) * cellBytes,
+                            src + ((size_t)(y - y0) * w + (ix0 - x0)) * cellBytes, rowBytes);
+            }
+            it->second.missing -= (size_t)(ix1 - ix0) * (iy1 - iy0);
+            if (it->second.missing == 0)
+            {
+                complete.push_back(std::make_pair(b, std::move(it->second.data)));
+                pending.erase(it);
+                ready.notify_one();
+            }
+        }
+    }
+}
+
+void BlockWriter::run()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;)
+    {
+        ready.wait(guard, [&]{ return !complete.empty() || closing; });
+        if (complete.empty())
+            break;
+        std::pair<size_t, std::vector<char>> block = std::move(complete.front());
+        complete.pop_front();
+
+        // The tiles keep coming while the block is written
+        guard.unlock();
+        int x0, y0, w, h;
+        window(block.first, x0, y0, w, h);
+        bool ok = flush(x0, y0, w, h, block.second.data());
+        guard.lock();
+        failed = failed || !ok;
+        held -= block.second.size();
+        written++;
+    }
+}
+
+bool BlockWriter::finish()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closing = true;
+        ready.notify_one();
+    }
+    if (writer.joinable())
+        writer.join();
+    return !failed && pending.empty() && written == (size_t)xBlocks * ((ySize + blockYSize - 1) / blockYSize);
+}
@@ -0,0 +1,71 @@
+/***************************************************************
+#                    spillDEM block write-out                  #
+****************************************************************
+#                                                              #
+#     Tiles come out of the tiled engines in any order and     #
+#   rarely match the blocks of the outputs. The block writer   #
+#   assembles them into output blocks and writes every block   #
+#   as soon as all its cells are in, from its own thread, so   #
+#   output I/O overlaps the remaining flood and a block is     #
+#   only held in memory while it is incomplete.                #
+#                                                              #
+***************************************************************/
+
+#ifndef SPILLDEM_BLOCKS_H
+#define SPILLDEM_BLOCKS_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class BlockWriter
+{
+public:
+    // Writes the complete block [x0, x0 + w) x [y0, y0 + h), rows w values
+    // apart. Only ever called from the writer thread.
+    typedef std::function<bool(int x0, int y0, int w, int h, const void* data)> Flush;
+
+    // Blocks of blockXSize x blockYSize cells of cellBytes bytes over a
+    // xSize x ySize raster
+    BlockWriter(int xSize, int ySize, int blockXSize, int blockYSize, size_t cellBytes, Flush flush);
+    ~BlockWriter();
+
+    // Copy the window [x0, x0 + w) x [y0, y0 + h), rows w values apart.
+    // Windows must not overlap. Called concurrently.
+    void write(int x0, int y0, int w, int h, const void* data);
+
+    // Wait until every queued block is written, false when a flush failed
+    // or some cells were never written
+    bool finish();
+
+    // Most bytes held by incomplete and queued blocks at any time
+    size_t peakBytes() const { return peak; }
+
+private:
+    struct Block
+    {
+        std::vector<char> data;
+        size_t missing;
+    };
+
+    void window(size_t b, int& x0, int& y0, int& w, int& h) const;
+    void run();
+
+    int xSize, ySize, blockXSize, blockYSize, xBlocks;
+    size_t cellBytes;
+    Flush flush;
+
+    std::mutex lock;
+    std::condition_variable ready;
+    std::unordered_map<size_t, Block> pending;
+    std::deque<std::pair<size_t, std::vector<char>>> complete;
+    size_t held = 0, peak = 0, written = 0;
+    bool failed = false, closing = false;
+    std::thread writer;
+};
+
+#endif
@@ -0,0 +1,316 @@
+/***************************************************************
+#                  spillDEM level-synchronous engine           #
+****************************************************************
+#                                                              #
+#     Parallel flood in the style of delta-stepping (Meyer &   #
+#   Sanders 2003). The spill elevations are cut in buckets of  #
+#   equal width, processed in increasing order. All threads    #
+#   expand the cells of the current bucket together, round     #
+#   after round, claiming their neighbours with atomic         #
+#   compare-and-swap, until the bucket stops changing. Cells   #
+#   lowered into the current bucket join the next round,       #
+#   cells lowered into a later bucket wait for it.             #
+#                                                              #
+***************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include "fill.h"
+#include "parallel.h"
+
+// Elevation buckets of the flood
+static const int bucketCount = 1024;
+// Frontier cells handed out at a time
+static const size_t chunkSize = 256;
+
+// Threads wait here until all of them arrived
+class SpinBarrier
+{
+public:
+    SpinBarrier(int count) : count(count), waiting(0), generation(0) {}
+
+    void wait()
+    {
+        unsigned g = generation.load();
+        if (waiting.fetch_add(1) + 1 == count)
+        {
+            waiting.store(0);
+            generation.fetch_add(1);
+        }
+        else
+        {
+            while (generation.load() == g)
+                std::this_thread::yield();
+        }
+    }
+
+private:
+    const int count;
+    std::atomic<int> waiting;
+    std::atomic<unsigned> generation;
+};
+
+// Floats as unsigned integers in the same order, so that a cell state, the
+// spill elevation above the index of the neighbour it was reached from,
+// compares as one 64 bit word
+static uint32_t orderedBits(float z)
+{
+    uint32_t u;
+    std::memcpy(&u, &z, sizeof u);
+    return u & 0x80000000u ? ~u : u | 0x80000000u;
+}
+
+static float fromOrderedBits(uint32_t u)
+{
+    u = u & 0x80000000u ? u & 0x7fffffffu : ~u;
+    float z;
+    std::memcpy(&z, &u, sizeof z);
+    return z;
+}
+
+static uint64_t packState(float spill, int d)
+{
+    return (uint64_t)orderedBits(spill) << 32 | (uint32_t)d;
+}
+
+static float stateSpill(uint64_t state)
+{
+    return fromOrderedBits((uint32_t)(state >> 32));
+}
+
+// Lower the state of a cell to spill, reached from neighbour d. Fails when
+// the cell is already at spill or below.
+static bool lowerState(std::atomic<uint64_t>& state, float spill, int d)
+{
+    const uint64_t wanted = packState(spill, d);
+    uint64_t current = state.load(std::memory_order_relaxed);
+    while ((current >> 32) > (wanted >> 32))
+    {
+        if (state.compare_exchange_weak(current, wanted, std::memory_order_relaxed))
+            return true;
+    }
+    return false;
+}
+
+void fillLevelSynchronous(float* elev, unsigned char* flowdir, int xSize, int ySize,
+                          const FillParams& params, FillStats* stats)
+{
+    Timer timer;
+    const float nodata = params.nodata;
+    const size_t cells = (size_t)xSize * ySize;
+    const int threads = std::max(1, params.threads);
+    // Pixel sizes as distances, north-up rasters have a negative pixel height
+    float pixelSizeX = std::fabs(params.pixelSizeX), pixelSizeY = std::fabs(params.pixelSizeY);
+    float diaglength = std::sqrt(pixelSizeX * pixelSizeX + pixelSizeY * pixelSizeY);
+    std::array<float, 8> length = { pixelSizeX, diaglength, pixelSizeY,
+                                    diaglength, pixelSizeX, diaglength,
+                                    pixelSizeY, diaglength};
+
+    auto isInBounds = [&](int x, int y){ return x >= 0 && x < xSize && y >= 0 && y < ySize; };
+    auto isSeed = [&](int x, int y)
+    {
+        for (int d = 0; d < 8; d++)
+        {
+            int nx = x + ngh[d].dx, ny = y + ngh[d].dy;
+            if (!isInBounds(nx, ny) || elev[(size_t)ny * xSize + nx] == nodata)
+                return true;
+        }
+        return false;
+    };
+
+    // Cell states: seeds hold their elevation and the "no direction" index
+    // 8, nodata cells the lowest state so that they are never lowered, the
+    // other cells start above everything
+    std::vector<std::atomic<uint64_t>> state(cells);
+    std::vector<std::atomic<unsigned char>> inFrontier(cells);
+    std::vector<float> rowMin(ySize, INFINITY), rowMax(ySize, -INFINITY);
+    std::vector<std::vector<size_t>> rowSeeds(ySize);
+    parallelFor(threads, ySize, [&](size_t y)
+    {
+        for (int x = 0; x < xSize; x++)
+        {
+            size_t c = y * xSize + x;
+            inFrontier[c].store(0, std::memory_order_relaxed);
+            if (elev[c] == nodata)
+            {
+                state[c].store(0, std::memory_order_relaxed);
+                continue;
+            }
+            rowMin[y] = std::min(rowMin[y], elev[c]);
+            rowMax[y] = std::max(rowMax[y], elev[c]);
+            if (isSeed(x, y))
+            {
+                state[c].store(packState(elev[c], 8), std::memory_order_relaxed);
+                rowSeeds[y].push_back(c);
+            }
+            else
+            {
+                state[c].store(~(uint64_t)0, std::memory_order_relaxed);
+            }
+        }
+    });
+    const float zmin = *std::min_element(rowMin.begin(), rowMin.end());
+    const float zmax = *std::max_element(rowMax.begin(), rowMax.end());
+    // Flat filling never raises a cell above the highest one
+    const float scale = zmax > zmin ? bucketCount / (zmax - zmin) : 0.0f;
+    auto bucketOf = [&](float spill){ return std::min(bucketCount - 1, (int)((spill - zmin) * scale)); };
+
+    // Cells waiting for a later bucket, per thread so that they are
+    // appended without locking. Entries go stale when the cell is lowered
+    // again, they are checked when their bucket comes.
+    std::vector<std::vector<std::vector<size_t>>> later(threads, std::vector<std::vector<size_t>>(bucketCount));
+    for (int y = 0; y < ySize; y++)
+    {
+        for (size_t c : rowSeeds[y])
+            later[0][bucketOf(elev[c])].push_back(c);
+    }
+    rowSeeds.clear();
+    rowSeeds.shrink_to_fit();
+    if (stats)
+        stats->addPhase("init", timer.lap());
+
+    std::vector<size_t> frontier;
+    std::vector<std::vector<size_t>> next(threads);
+    std::atomic<size_t> taken(0);
+    std::vector<size_t> pops(threads, 0);
+    size_t pushes = 0;
+    int bucket = -1;
+    bool done = false;
+    SpinBarrier barrier(threads);
+
+    // Move the cells of the next bucket still holding a state in it to the
+    // frontier, skipping the buckets left empty. Run by one thread.
+    auto openBucket = [&]()
+    {
+        while (frontier.empty() && ++bucket < bucketCount)
+        {
+            for (int t = 0; t < threads; t++)
+            {
+                for (size_t c : later[t][bucket])
+                {
+                    float spill = stateSpill(state[c].load(std::memory_order_relaxed));
+                    if (bucketOf(spill) == bucket && !inFrontier[c].exchange(1, std::memory_order_relaxed))
+                        frontier.push_back(c);
+                }
+                std::vector<size_t>().swap(later[t][bucket]);
+            }
+        }
+        done = frontier.empty();
+        pushes += frontier.size();
+    };
+    openBucket();
+
+    parallelFor(threads, threads, [&](size_t t)
+    {
+        while (!done)
+        {
+            size_t i0;
+            while ((i0 = taken.fetch_add(chunkSize, std::memory_order_relaxed)) < frontier.size())
+            {
+                size_t i1 = std::min(frontier.size(), i0 + chunkSize);
+                for (size_t i = i0; i < i1; i++)
+                {
+                    size_t c = frontier[i];
+                    // Cleared first: a neighbour lowering the cell again
+                    // from now on puts it back in the next round
+                    inFrontier[c].store(0, std::memory_order_relaxed);
+                    float z = stateSpill(state[c].load(std::memory_order_relaxed));
+                    int x = (int)(c % xSize), y = (int)(c / xSize);
+                    pops[t]++;
+                    for (int d = 0; d < 8; d++)
+                    {
+                        int nx = x + ngh[d].dx, ny = y + ngh[d].dy;
+                        if (!isInBounds(nx, ny))
+                            continue;
+                        size_t n = (size_t)ny * xSize + nx;
+                        float nz = std::max(elev[n], z);
+                        if (!lowerState(state[n], nz, (d + 4) % 8))
+                            continue;
+                        int b = bucketOf(nz);
+                        if (b > bucket)
+                            later[t][b].push_back(n);
+                        else if (!inFrontier[n].exchange(1, std::memory_order_relaxed))
+                            next[t].push_back(n);
+                    }
+                }
+            }
+            barrier.wait();
+            if (t == 0)
+            {
+                frontier.clear();
+                for (std::vector<size_t>& cellsOfThread : next)
+                {
+                    frontier.insert(frontier.end(), cellsOfThread.begin(), cellsOfThread.end());
+                    cellsOfThread.clear();
+                }
+                pushes += frontier.size();
+                if (frontier.empty())
+                    openBucket();
+                taken.store(0);
+            }
+            barrier.wait();
+        }
+    });
+    if (stats)
+        stats->addPhase("flood", timer.lap());
+
+    // The states are final. A cell drains to its steepest strictly lower
+    // neighbour, or else to the neighbour it was reached from: along those
+    // the spill elevation never rises and, at equal spill elevations, the
+    // neighbour got its final state first, so the directions cannot loop.
+    parallelFor(threads, ySize, [&](size_t y)
+    {
+        for (int x = 0; x < xSize; x++)
+        {
+            size_t c = y * xSize + x;
+            if (elev[c] == nodata)
+            {
+                flowdir[c] = 255;
+                continue;
+            }
+            uint64_t s = state[c].load(std::memory_order_relaxed);
+            float z = stateSpill(s);
+            int from = (int)(s & 0xff);
+            if (from == 8)
+            {
+                flowdir[c] = 255;
+                continue;
+            }
+            float maxgrad = 0.0f;
+            int dmax = from;
+            for (int d = 0; d < 8; d++)
+            {
+                int nx = x + ngh[d].dx, ny = (int)y + ngh[d].dy;
+                if (!isInBounds(nx, ny) || elev[(size_t)ny * xSize + nx] == nodata)
+                    continue;
+                float grad = (z - stateSpill(state[(size_t)ny * xSize + nx].load(std::memory_order_relaxed))) / length[d];
+                if (grad > maxgrad)
+                {
+                    maxgrad = grad;
+                    dmax = d;
+                }
+            }
+            flowdir[c] = ldd[dmax];
+        }
+    });
+    // Only now, the directions above compare the states of neighbours
+    parallelFor(threads, ySize, [&](size_t y)
+    {
+        for (size_t c = y * xSize; c < (y + 1) * xSize; c++)
+        {
+            if (elev[c] != nodata)
+                elev[c] = stateSpill(state[c].load(std::memory_order_relaxed));
+        }
+    });
+    if (stats)
+    {
+        stats->addPhase("directions", timer.lap());
+        stats->pushes += pushes;
+        for (size_t p : pops)
+            stats->pops += p;
+    }
+}
@@ -0,0 +1,428 @@
+#include <algorithm>
+#include <atomic>
+#include "cluster.h"
+#include "net.h"
+#include "parallel.h"
+
+static const uint32_t protocolVersion = 2;
+
+enum MessageType : uint32_t
+{
+    AssignMessage = 1,     // coordinator: layout and strip of the worker
+    SummariesMessage = 2,  // worker: summaries of its tiles
+    PerimetersMessage = 3, // coordinator: filled perimeters the worker needs
+    DoneMessage = 4,       // worker: outcome and output files
+    FlatsMessage = 5,      // worker: flats crossing the edges of its tiles
+    RanksMessage = 6       // coordinator: flat ranks the worker needs
+};
+
+// First row and number of rows of tiles of worker i
+static void stripRows(const TileLayout& layout, int workers, int i, int& first, int& rows)
+{
+    first = (int)((int64_t)layout.yTiles * i / workers);
+    rows = (int)((int64_t)layout.yTiles * (i + 1) / workers) - first;
+}
+
+static bool receiveExpected(int fd, uint32_t expected, std::vector<char>& payload)
+{
+    uint32_t type;
+    return receiveMessage(fd, type, payload) && type == expected;
+}
+
+// Worker summaries are checked before the spill graph indexes with them:
+// perimeters of the size of the tile and labels within the tile count,
+// which is at most one per cell plus the ocean label
+static bool validSummary(const TileLayout& layout, int t, const TileSummary& s)
+{
+    int x0, y0, w, h;
+    layout.window(t, x0, y0, w, h);
+    const size_t perimeter = 2 * (size_t)w + 2 * (size_t)h;
+    if (s.labels < 1 || s.labels > (uint64_t)w * h + 1
+        || s.sideLabels.size() != perimeter || s.sideElev.size() != perimeter)
+        return false;
+    for (uint32_t l : s.sideLabels)
+    {
+        if (l > s.labels)
+            return false;
+    }
+    for (const auto& e : s.edges)
+    {
+        uint32_t a = e.first >> 32, b = e.first & 0xffffffff;
+        if (a < 1 || a > s.labels || b < 1 || b > s.labels)
+            return false;
+    }
+    return true;
+}
+
+// Likewise flat summaries: no flats, or a flat within the count for every
+// perimeter cell
+static bool validFlats(const TileLayout& layout, int t, const FlatSummary& s)
+{
+    int x0, y0, w, h;
+    layout.window(t, x0, y0, w, h);
+    if (s.sideFlats.empty())
+        return true;
+    if (s.sideFlats.size() != 2 * (size_t)w + 2 * (size_t)h)
+        return false;
+    for (uint32_t f : s.sideFlats)
+    {
+        if (f > s.exits.size())
+            return false;
+    }
+    return true;
+}
+
+// First and end rows of tiles whose perimeters worker i needs: those of its
+// strip and of the rows just above and below, which make the halos of its
+// edge tiles
+static void haloRows(const TileLayout& layout, int workers, int i, int& top, int& bottom)
+{
+    int first, rows;
+    stripRows(layout, workers, i, first, rows);
+    top = rows ? std::max(0, first - 1) : first;
+    bottom = rows ? std::min(layout.yTiles, first + rows + 1) : first;
+}
+
+bool runCoordinator(const std::string& address, int port, int workers, const TileLayout& layout, float nodata,
+                    std::vector<WorkerPart>& parts, FillStats* stats)
+{
+    Timer timer;
+    int server = listenTcp(address, port);
+    if (server < 0)
+    {
+        fprintf(stderr, "Error: Cannot listen on %s port %d\n", address.c_str(), port);
+        return false;
+    }
+    std::vector<int> fds;
+    for (int i = 0; i < workers; i++)
+    {
+        int fd = acceptTcp(server);
+        if (fd < 0)
+            break;
+        fds.push_back(fd);
+    }
+    closeTcp(server);
+    auto fail = [&](const char* what, int i)
+    {
+        fprintf(stderr, "Error: Worker %d failed %s\n", i, what);
+        for (int fd : fds)
+            closeTcp(fd);
+        return false;
+    };
+    if ((int)fds.size() != workers)
+        return fail("to connect", (int)fds.size());
+
+    for (int i = 0; i < workers; i++)
+    {
+        int first, rows;
+        stripRows(layout, workers, i, first, rows);
+        MessageWriter m;
+        m.put<uint32_t>(protocolVersion);
+        m.put<int32_t>(layout.xSize);
+        m.put<int32_t>(layout.ySize);
+        m.put<int32_t>(layout.tileSize);
+        m.put<float>(nodata);
+        m.put<int32_t>(i);
+        m.put<int32_t>(first);
+        m.put<int32_t>(rows);
+        if (!sendMessage(fds[i], AssignMessage, m.data))
+            return fail("to receive its strip", i);
+    }
+    if (stats)
+        stats->addPhase("connect", timer.lap());
+
+    // Gather the summaries of every tile, from the worker owning it
+    std::vector<TileSummary> summaries(layout.count());
+    std::vector<bool> received(layout.count(), false);
+    std::vector<char> payload;
+    for (int i = 0; i < workers; i++)
+    {
+        int first, rows;
+        stripRows(layout, workers, i, first, rows);
+        if (!receiveExpected(fds[i], SummariesMessage, payload))
+            return fail("labelling its tiles", i);
+        MessageReader r(payload);
+        uint64_t count = r.get<uint64_t>();
+        if (count != (uint64_t)rows * layout.xTiles)
+            return fail("labelling its tiles", i);
+        for (uint64_t k = 0; k < count && r.ok; k++)
+        {
+            int t = r.get<int32_t>();
+            if (t < first * layout.xTiles || t >= (first + rows) * layout.xTiles || received[t])
+                return fail("labelling its tiles", i);
+            received[t] = true;
+            TileSummary& s = summaries[t];
+            s.labels = r.get<uint32_t>();
+            r.getArray(s.sideLabels);
+            r.getArray(s.sideElev);
+            std::vector<uint64_t> keys;
+            std::vector<float> spills;
+            r.getArray(keys);
+            r.getArray(spills);
+            if (keys.size() != spills.size())
+                r.ok = false;
+            s.edges.resize(keys.size());
+            for (size_t e = 0; e < keys.size(); e++)
+                s.edges[e] = std::make_pair(keys[e], spills[e]);
+            if (r.ok && !validSummary(layout, t, s))
+                r.ok = false;
+        }
+        if (!r.ok)
+            return fail("labelling its tiles", i);
+    }
+    if (stats)
+        stats->addPhase("label", timer.lap());
+
+    TileGraph graph;
+    graph.solve(layout, nodata, summaries);
+    std::vector<TileSummary>().swap(summaries);
+    if (stats)
+        stats->addPhase("solve", timer.lap());
+
+    // Every worker gets the perimeters around its strip
+    std::vector<float> values;
+    for (int i = 0; i < workers; i++)
+    {
+        int top, bottom;
+        haloRows(layout, workers, i, top, bottom);
+        MessageWriter m;
+        m.put<uint64_t>((uint64_t)(bottom - top) * layout.xTiles);
+        for (int t = top * layout.xTiles; t < bottom * layout.xTiles; t++)
+        {
+            graph.tilePerimeter(t, values);
+            m.put<int32_t>(t);
+            m.putArray(values);
+        }
+        if (!sendMessage(fds[i], PerimetersMessage, m.data))
+            return fail("to receive the perimeters", i);
+    }
+
+    // The flats crossing tile edges, ranked over the whole DEM and sent back
+    // like the perimeters
+    std::vector<FlatSummary> flats(layout.count());
+    received.assign(layout.count(), false);
+    for (int i = 0; i < workers; i++)
+    {
+        int first, rows;
+        stripRows(layout, workers, i, first, rows);
+        if (!receiveExpected(fds[i], FlatsMessage, payload))
+            return fail("finding the flats of its tiles", i);
+        MessageReader r(payload);
+        uint64_t count = r.get<uint64_t>();
+        if (count != (uint64_t)rows * layout.xTiles)
+            return fail("finding the flats of its tiles", i);
+        for (uint64_t k = 0; k < count && r.ok; k++)
+        {
+            int t = r.get<int32_t>();
+            if (t < first * layout.xTiles || t >= (first + rows) * layout.xTiles || received[t])
+                return fail("finding the flats of its tiles", i);
+            received[t] = true;
+            r.getArray(flats[t].sideFlats);
+            r.getArray(flats[t].exits);
+            if (r.ok && !validFlats(layout, t, flats[t]))
+                r.ok = false;
+        }
+        if (!r.ok)
+            return fail("finding the flats of its tiles", i);
+    }
+    graph.solveFlats(flats);
+    std::vector<FlatSummary>().swap(flats);
+    std::vector<uint32_t> ranks;
+    for (int i = 0; i < workers; i++)
+    {
+        int top, bottom;
+        haloRows(layout, workers, i, top, bottom);
+        MessageWriter m;
+        m.put<uint64_t>((uint64_t)(bottom - top) * layout.xTiles);
+        for (int t = top * layout.xTiles; t < bottom * layout.xTiles; t++)
+        {
+            graph.tileFlatRanks(t, ranks);
+            m.put<int32_t>(t);
+            m.putArray(ranks);
+        }
+        if (!sendMessage(fds[i], RanksMessage, m.data))
+            return fail("to receive the flat ranks", i);
+    }
+    if (stats)
+        stats->addPhase("flats", timer.lap());
+
+    parts.assign(workers, WorkerPart());
+    for (int i = 0; i < workers; i++)
+    {
+        if (!receiveExpected(fds[i], DoneMessage, payload))
+            return fail("filling its strip", i);
+        MessageReader r(payload);
+        bool ok = r.get<uint8_t>() != 0;
+        parts[i].filled = r.getString();
+        parts[i].flow = r.getString();
+        if (!ok || !r.ok)
+            return fail("filling its strip", i);
+        int first, rows;
+        stripRows(layout, workers, i, first, rows);
+        parts[i].y0 = std::min(layout.ySize, first * layout.tileSize);
+        parts[i].h = std::min(layout.ySize, (first + rows) * layout.tileSize) - parts[i].y0;
+    }
+    if (stats)
+        stats->addPhase("fill", timer.lap());
+    for (int fd : fds)
+        closeTcp(fd);
+    return true;
+}
+
+ClusterWorker::~ClusterWorker()
+{
+    closeTcp(fd);
+}
+
+bool ClusterWorker::connect(const std::string& host, int port, int xSize, int ySize)
+{
+    fd = connectTcp(host, port);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error: Cannot connect to the coordinator at %s:%d\n", host.c_str(), port);
+        return false;
+    }
+    std::vector<char> payload;
+    if (!receiveExpected(fd, AssignMessage, payload))
+        return false;
+    MessageReader r(payload);
+    uint32_t version = r.get<uint32_t>();
+    int x = r.get<int32_t>(), y = r.get<int32_t>(), tileSize = r.get<int32_t>();
+    nodataValue = r.get<float>();
+    workerIndex = r.get<int32_t>();
+    firstRow = r.get<int32_t>();
+    rows = r.get<int32_t>();
+    if (!r.ok || version != protocolVersion || tileSize < 3)
+        return false;
+    if (x != xSize || y != ySize)
+    {
+        fprintf(stderr, "Error: The coordinator expects a %d x %d DEM\n", x, y);
+        return false;
+    }
+    layout = TileLayout(xSize, ySize, tileSize);
+    own.clear();
+    for (int t = firstRow * layout.xTiles; t < (firstRow + rows) * layout.xTiles; t++)
+        own.push_back(t);
+    return true;
+}
+
+void ClusterWorker::strip(int& y0, int& h) const
+{
+    y0 = std::min(layout.ySize, firstRow * layout.tileSize);
+    h = std::min(layout.ySize, (firstRow + rows) * layout.tileSize) - y0;
+}
+
+bool ClusterWorker::summarize(const WindowReader& read, int threads, FillStats* stats)
+{
+    Timer timer;
+    std::vector<TileSummary> summaries(own.size());
+    std::atomic<bool> ok(true);
+    parallelFor(threads, own.size(), [&](size_t i)
+    {
+        if (ok && !summarizeTile(layout, own[i], read, nodataValue, summaries[i]))
+            ok = false;
+    });
+    if (!ok)
+        return false;
+    if (stats)
+        stats->addPhase("label", timer.lap());
+
+    MessageWriter m;
+    m.put<uint64_t>(own.size());
+    std::vector<uint64_t> keys;
+    std::vector<float> spills;
+    for (size_t i = 0; i < own.size(); i++)
+    {
+        const TileSummary& s = summaries[i];
+        m.put<int32_t>(own[i]);
+        m.put<uint32_t>(s.labels);
+        m.putArray(s.sideLabels);
+        m.putArray(s.sideElev);
+        keys.clear();
+        spills.clear();
+        for (const auto& e : s.edges)
+        {
+            keys.push_back(e.first);
+            spills.push_back(e.second);
+        }
+        m.putArray(keys);
+        m.putArray(spills);
+    }
+    return sendMessage(fd, SummariesMessage, m.data);
+}
+
+bool ClusterWorker::fill(const WindowReader& read, const FillParams& params, const TileSink& sink,
+                         FillStats* stats)
+{
+    Timer timer;
+    std::vector<char> payload;
+    if (!receiveExpected(fd, PerimetersMessage, payload))
+        return false;
+    if (stats)
+        stats->addPhase("solve", timer.lap());
+
+    // Only the perimeters around the strip are known, the others stay nodata
+    TileGraph graph;
+    graph.reset(layout, nodataValue);
+    MessageReader r(payload);
+    uint64_t count = r.get<uint64_t>();
+    std::vector<float> values;
+    for (uint64_t k = 0; k < count && r.ok; k++)
+    {
+        int t = r.get<int32_t>();
+        r.getArray(values);
+        std::vector<float> expected;
+        if (t < 0 || t >= layout.count() || !graph.tilePerimeter(t, expected) || expected.size() != values.size())
+            return false;
+        graph.setTilePerimeter(t, values);
+    }
+    if (!r.ok)
+        return false;
+
+    // Flats of the strip crossing tile edges, ranked by the coordinator
+    std::vector<FlatSummary> flats(own.size());
+    std::atomic<bool> ok(true);
+    parallelFor(params.threads, own.size(), [&](size_t i)
+    {
+        if (ok && graph.crossesFlat(own[i]) && !graph.summarizeFlats(own[i], read, flats[i]))
+            ok = false;
+    });
+    if (!ok)
+        return false;
+    MessageWriter m;
+    m.put<uint64_t>(own.size());
+    for (size_t i = 0; i < own.size(); i++)
+    {
+        m.put<int32_t>(own[i]);
+        m.putArray(flats[i].sideFlats);
+        m.putArray(flats[i].exits);
+    }
+    if (!sendMessage(fd, FlatsMessage, m.data) || !receiveExpected(fd, RanksMessage, payload))
+        return false;
+    MessageReader ranks(payload);
+    count = ranks.get<uint64_t>();
+    std::vector<uint32_t> tileRanks;
+    for (uint64_t k = 0; k < count && ranks.ok; k++)
+    {
+        int t = ranks.get<int32_t>();
+        ranks.getArray(tileRanks);
+        std::vector<uint32_t> expected;
+        if (t < 0 || t >= layout.count() || !graph.tileFlatRanks(t, expected) || expected.size() != tileRanks.size())
+            return false;
+        graph.setTileFlatRanks(t, tileRanks);
+    }
+    if (!ranks.ok)
+        return false;
+    if (stats)
+        stats->addPhase("flats", timer.lap());
+    return fillTiled(graph, own, read, params, sink, stats);
+}
+
+bool ClusterWorker::finish(bool ok, const std::string& filled, const std::string& flow)
+{
+    MessageWriter m;
+    m.put<uint8_t>(ok ? 1 : 0);
+    m.putString(filled);
+    m.putString(flow);
+    return sendMessage(fd, DoneMessage, m.data);
+}
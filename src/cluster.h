@@ -0,0 +1,76 @@
+/***************************************************************
+#                   spillDEM distributed tiling                #
+****************************************************************
+#                                                              #
+#     Coordinator and worker processes for the exact tiled     #
+#   fill. The coordinator hands out strips of tile rows. Each  #
+#   worker floods its tiles on their own and sends the tile    #
+#   summaries back; the coordinator solves the global spill    #
+#   graph and returns to every worker the filled perimeters of #
+#   its tiles and of the tiles bordering its strip. A second   #
+#   round the same way ranks the flats crossing tile edges,    #
+#   from which the worker fills its strip exactly and writes   #
+#   it out.                                                    #
+#                                                              #
+***************************************************************/
+
+#ifndef SPILLDEM_CLUSTER_H
+#define SPILLDEM_CLUSTER_H
+
+#include <string>
+#include <vector>
+#include "tiles.h"
+
+// Strip of the DEM filled by one worker and the files it wrote
+struct WorkerPart
+{
+    int y0 = 0;
+    int h = 0;
+    std::string filled;
+    std::string flow;
+};
+
+// Wait for `workers` workers on the local address and port, and drive
+// them through the fill. parts receives the strip of every worker, in
+// order.
+bool runCoordinator(const std::string& address, int port, int workers, const TileLayout& layout, float nodata,
+                    std::vector<WorkerPart>& parts, FillStats* stats = nullptr);
+
+class ClusterWorker
+{
+public:
+    ClusterWorker() {}
+    ~ClusterWorker();
+
+    // Join the coordinator and receive the strip to fill. The DEM must have
+    // the size the coordinator expects.
+    bool connect(const std::string& host, int port, int xSize, int ySize);
+    int index() const { return workerIndex; }
+    // Rows [y0, y0 + h) of the DEM, h may be 0 with more workers than rows
+    // of tiles
+    void strip(int& y0, int& h) const;
+    float nodata() const { return nodataValue; }
+
+    // Flood the tiles of the strip and send their summaries
+    bool summarize(const WindowReader& read, int threads, FillStats* stats = nullptr);
+    // Receive the solved perimeters, exchange the flats of the strip for
+    // their ranks and fill the strip, handing every tile to sink
+    bool fill(const WindowReader& read, const FillParams& params, const TileSink& sink,
+              FillStats* stats = nullptr);
+    // Report the files written, or a failure, to the coordinator
+    bool finish(bool ok, const std::string& filled, const std::string& flow);
+
+private:
+    ClusterWorker(const ClusterWorker&);
+    ClusterWorker& operator=(const ClusterWorker&);
+
+    int fd = -1;
+    TileLayout layout;
+    float nodataValue = 0.0f;
+    int workerIndex = -1;
+    int firstRow = 0;
+    int rows = 0;
+    std::vector<int> own;
+};
+
+#endif
@@ -0,0 +1,109 @@
+#include <cmath>
+#include <limits>
+#include "costdist.h"
+#include "trace.h"
+
+template <class Queue>
+static void dijkstra(const float* cost, const unsigned char* source, int xSize, int ySize,
+                     const FillParams& params, Queue& queue, float* accumulated,
+                     unsigned char* backlink, FillStats* stats)
+{
+    Timer timer;
+    const float nodata = params.nodata;
+    const float infinity = std::numeric_limits<float>::infinity();
+    float pixelSizeX = std::fabs(params.pixelSizeX), pixelSizeY = std::fabs(params.pixelSizeY);
+    float diaglength = std::sqrt(pixelSizeX * pixelSizeX + pixelSizeY * pixelSizeY);
+    std::array<float, 8> length = { pixelSizeX, diaglength, pixelSizeY,
+                                    diaglength, pixelSizeX, diaglength,
+                                    pixelSizeY, diaglength};
+
+    auto getIndex = [&](int x, int y){ return (size_t)y * xSize + x; };
+    auto isInBounds = [&](int x, int y){ return x >= 0 && x < xSize && y >= 0 && y < ySize; };
+    auto isBarrier = [&](size_t c){ return cost[c] == nodata || cost[c] < 0.0f; };
+
+    size_t pushes = 0, pops = 0;
+    for (int y = 0; y < ySize; y++)
+    {
+        for (int x = 0; x < xSize; x++)
+        {
+            size_t c = getIndex(x, y);
+            accumulated[c] = infinity;
+            backlink[c] = 255;
+            if (source[c] && !isBarrier(c))
+            {
+                accumulated[c] = 0.0f;
+                backlink[c] = 0;
+                queue.push(node(0.0f, x, y));
+                pushes++;
+            }
+        }
+    }
+    if (stats)
+        stats->addPhase("init", timer.lap());
+
+    // Cells may be queued several times as their cost drops, only the
+    // lowest entry is expanded
+    while (!queue.empty())
+    {
+        node current = queue.top();
+        queue.pop();
+        pops++;
+        size_t c = getIndex(current.x, current.y);
+        if (current.spill > accumulated[c])
+            continue;
+        for (int d = 0; d < 8; d++)
+        {
+            int nx = current.x + ngh[d].dx, ny = current.y + ngh[d].dy;
+            if (!isInBounds(nx, ny))
+                continue;
+            size_t n = getIndex(nx, ny);
+            if (isBarrier(n))
+                continue;
+            float total = current.spill + 0.5f * (cost[c] + cost[n]) * length[d];
+            if (total < accumulated[n])
+            {
+                accumulated[n] = total;
+                backlink[n] = ldd[(d + 4) % 8];
+                queue.push(node(total, nx, ny));
+                pushes++;
+            }
+        }
+    }
+
+    for (size_t c = 0; c < (size_t)xSize * ySize; c++)
+    {
+        if (std::isinf(accumulated[c]))
+            accumulated[c] = nodata;
+    }
+    if (stats)
+    {
+        stats->addPhase("flood", timer.lap());
+        stats->pushes += pushes;
+        stats->pops += pops;
+    }
+}
+
+struct costflood
+{
+    const float* cost;
+    const unsigned char* source;
+    int xSize, ySize;
+    const FillParams& params;
+    float* accumulated;
+    unsigned char* backlink;
+    FillStats* stats;
+
+    template <class Queue>
+    void operator()(Queue& queue)
+    {
+        dijkstra(cost, source, xSize, ySize, params, queue, accumulated, backlink, stats);
+    }
+};
+
+void costDistance(const float* cost, const unsigned char* source, int xSize, int ySize,
+                  const FillParams& params, float* accumulated, unsigned char* backlink,
+                  FillStats* stats)
+{
+    costflood flood = { cost, source, xSize, ySize, params, accumulated, backlink, stats };
+    floodWithSelectedQueue(params, xSize, flood);
+}
@@ -0,0 +1,29 @@
+/***************************************************************
+#                   spillDEM cost distance                     #
+****************************************************************
+#                                                              #
+#     Accumulated cost distance over a raster, run on the      #
+#   same priority queues as the filling engines: a flood from  #
+#   the source cells is Dijkstra's algorithm on the D8 grid.   #
+#                                                              #
+***************************************************************/
+
+#ifndef SPILLDEM_COSTDIST_H
+#define SPILLDEM_COSTDIST_H
+
+#include "fill.h"
+
+// Accumulated cost from the nearest source to every cell. Moving between
+// two neighbours costs the mean of their costs times the distance between
+// their centres (params.pixelSizeX/Y). Cells where cost is nodata or
+// negative are barriers; sources are the cells where source is non zero.
+//
+// backlink receives, for every reached cell, the flow direction code
+// (ldd) of the neighbour its least-cost path comes from: following the
+// backlinks leads to a source. Sources get 0, barriers and unreachable
+// cells 255, with a nodata accumulated cost.
+void costDistance(const float* cost, const unsigned char* source, int xSize, int ySize,
+                  const FillParams& params, float* accumulated, unsigned char* backlink,
+                  FillStats* stats = nullptr);
+
+#endif
@@ -0,0 +1,82 @@
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <vector>
+#include "ensemble.h"
+#include "parallel.h"
+
+void fillEnsemble(const float* elev, int xSize, int ySize, const FillParams& params, FillFunction fill,
+                  const EnsembleParams& ensemble, float* probability, float* depth, FillStats* stats)
+{
+    Timer timer;
+    const size_t cells = (size_t)xSize * ySize;
+    const float nodata = params.nodata;
+    const int threads = std::min(std::max(1, params.threads), ensemble.runs);
+
+    // Every run fills serially, the runs are spread over the threads
+    FillParams runParams = params;
+    runParams.threads = 1;
+    runParams.trace = nullptr;
+
+    std::vector<uint32_t> raised(cells, 0);
+    std::vector<double> raise(cells, 0.0);
+    std::mutex mergeLock;
+    size_t pushes = 0, pops = 0;
+
+    // Every thread perturbs and fills its own copy, taking runs one at a time
+    std::atomic<int> nextRun(0);
+    parallelFor(threads, threads, [&](size_t)
+    {
+        std::vector<float> perturbed(cells);
+        std::vector<unsigned char> flowdir(cells);
+        std::normal_distribution<float> error(0.0f, ensemble.rmse);
+        int run;
+        while ((run = nextRun.fetch_add(1)) < ensemble.runs)
+        {
+            std::mt19937 random(ensemble.seed + run);
+            for (size_t c = 0; c < cells; c++)
+                perturbed[c] = elev[c] == nodata ? nodata : elev[c] + error(random);
+            error.reset();
+
+            FillStats runStats;
+            fill(perturbed.data(), flowdir.data(), xSize, ySize, runParams, &runStats);
+
+            // Turn the filled copy into the raise, regenerating the error
+            // field rather than keeping a second copy
+            random.seed(ensemble.seed + run);
+            for (size_t c = 0; c < cells; c++)
+                if (elev[c] != nodata)
+                    perturbed[c] -= elev[c] + error(random);
+            error.reset();
+
+            std::lock_guard<std::mutex> lock(mergeLock);
+            for (size_t c = 0; c < cells; c++)
+            {
+                if (elev[c] != nodata && perturbed[c] > 0.0f)
+                {
+                    raised[c]++;
+                    raise[c] += perturbed[c];
+                }
+            }
+            pushes += runStats.pushes;
+            pops += runStats.pops;
+        }
+    });
+
+    for (size_t c = 0; c < cells; c++)
+    {
+        if (elev[c] == nodata)
+        {
+            probability[c] = depth[c] = nodata;
+            continue;
+        }
+        probability[c] = (float)raised[c] / ensemble.runs;
+        depth[c] = (float)(raise[c] / ensemble.runs);
+    }
+    if (stats)
+    {
+        stats->addPhase("ensemble", timer.lap());
+        stats->pushes += pushes;
+        stats->pops += pops;
+    }
+}
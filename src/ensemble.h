@@ -0,0 +1,38 @@
+/***************************************************************
+#                  spillDEM Monte Carlo ensemble               #
+****************************************************************
+#                                                              #
+#     Depression filling under vertical uncertainty, after     #
+#   Lindsay & Creed (2006): the DEM is perturbed with a random #
+#   error field and filled many times, giving for every cell   #
+#   the probability to lie in a depression and its expected    #
+#   depth.                                                     #
+#                                                              #
+***************************************************************/
+
+#ifndef SPILLDEM_ENSEMBLE_H
+#define SPILLDEM_ENSEMBLE_H
+
+#include <cstdint>
+#include "fill.h"
+
+// Vertical error model: uncorrelated Gaussian error of the given RMSE
+struct EnsembleParams
+{
+    int runs = 100;
+    float rmse = 1.0f;
+    uint32_t seed = 0;
+};
+
+// Fill runs perturbed copies of elev with fill, params.threads at a time.
+// elev is shared read-only; every thread perturbs its own copy on the fly,
+// so memory grows with the thread count, not with the number of runs. Run
+// i draws its error field from seed + i, the result does not depend on the
+// thread count.
+//
+// probability receives the fraction of runs where a cell was raised, depth
+// the mean raise over all runs. Nodata cells get nodata in both.
+void fillEnsemble(const float* elev, int xSize, int ySize, const FillParams& params, FillFunction fill,
+                  const EnsembleParams& ensemble, float* probability, float* depth, FillStats* stats = nullptr);
+
+#endif
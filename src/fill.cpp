@@ -0,0 +1,304 @@
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <queue>
+#include "fill.h"
+#include "flats.h"
+#include "links.h"
+#include "tiles.h"
+#include "trace.h"
+
+const std::array<dir, 8> ngh = { dir(1, 0), dir(1, -1), dir(0, -1),
+                                 dir(-1, -1), dir(-1, 0), dir(-1, 1),
+                                 dir(0, 1), dir(1, 1) };
+const std::array<unsigned char, 9> ldd = {6, 3, 2, 1, 4, 7, 8, 9, 0};
+
+const std::vector<engine>& fillEngines()
+{
+    static const std::vector<engine> engines = {
+        {"pq", "priority queue flood (Wang & Liu)", false, true, fillPriorityFlood},
+        {"zhou", "priority flood with region growing (Zhou, Sun & Fu 2016)", false, true, fillRegionGrowing},
+        {"tiled", "exact tiled flood (Barnes 2016), flat filling only", true, false, fillTiledInMemory},
+        {"bucket", "level-synchronous flood by elevation bucket, flat filling only", true, false, fillLevelSynchronous},
+        {"basins", "parallel flood of watershed partitions, flat filling only", true, false, fillWatershedPartitioned},
+    };
+    return engines;
+}
+
+const engine* findEngine(const std::string& name)
+{
+    for (const engine& e : fillEngines())
+    {
+        if (name == e.name)
+            return &e;
+    }
+    return nullptr;
+}
+
+template <class Queue>
+static void priorityFlood(float* elev, unsigned char* flowdir, int xSize, int ySize,
+                          const FillParams& params, Queue& queue, FillStats* stats)
+{
+    Timer timer;
+    const float nodata = params.nodata;
+    bool preserve;
+    float minslope = params.minslope;
+    // Pixel sizes as distances, north-up rasters have a negative pixel height
+    float pixelSizeX = std::fabs(params.pixelSizeX), pixelSizeY = std::fabs(params.pixelSizeY);
+    float diaglength = std::sqrt(pixelSizeX * pixelSizeX + pixelSizeY * pixelSizeY);
+    std::array<float, 8> length = { pixelSizeX, diaglength, pixelSizeY,
+                                    diaglength, pixelSizeX, diaglength,
+                                    pixelSizeY, diaglength};
+    std::array<float, 8> mindiff;
+
+    if( minslope > 0.0 )
+	{
+		minslope = std::tan(minslope * M_PI / 180.0);
+		for(int d=0; d<8; d++)
+			mindiff[d] = minslope * length[d];
+		preserve = true;
+	}
+	else
+    {
+		preserve = false;
+    }
+
+    // Links are neighbours at their own length, index linkDir in getFlowDir
+    const FlowLinks* links = params.links && !params.links->empty() ? params.links : nullptr;
+    const int linkDir = 9;
+    auto getLinkLength = [&](int c){ return (float)links->length(c, pixelSizeX, pixelSizeY); };
+
+    // Past the east and west edges, either outside or around the globe
+    const bool wrapX = params.wrapX;
+    auto getNeighbourX = [&](int x, int d)
+    {
+        x += ngh[d].dx;
+        return !wrapX ? x : x < 0 ? x + xSize : x >= xSize ? x - xSize : x;
+    };
+    auto getNeighbourY = [&](int y, int d){ return y + ngh[d].dy; };
+    auto getIndex = [&](int x, int y){ return y * xSize + x; };
+    auto isInBounds = [&](int x, int y){ return x >= 0 && x < xSize && y >= 0 && y < ySize; };
+
+    CellBits queued((size_t)xSize*ySize);
+    CellBits processed((size_t)xSize*ySize);
+    std::fill(flowdir, flowdir + (size_t)xSize*ySize, 0);
+
+    auto getFlowDir = [&](int x, int y, float z)
+    {
+        float maxgrad = -1.0, grad;
+        char dmax = 8;
+        int nx, ny, n;
+        for (int d = 0; d < 8; d++)
+        {
+            nx = getNeighbourX(x, d);
+            ny = getNeighbourY(y, d);
+            n = getIndex(nx ,ny);
+            if ( isInBounds(nx, ny) && processed[n] && elev[n] <= z)
+            {
+                grad = (z - elev[n]) / length[d];
+                if (grad > maxgrad)
+                {
+                    maxgrad = grad;
+                    dmax = d;
+                }
+            }
+        }
+        int c = getIndex(x, y);
+        if (links && links->linked(c))
+        {
+            int p = links->partner(c);
+            if (processed[p] && elev[p] != nodata && elev[p] <= z && (z - elev[p]) / getLinkLength(c) > maxgrad)
+                dmax = linkDir;
+        }
+        return dmax;
+    };
+
+    int c, n, nx, ny;
+    float z, nz;
+    size_t pushes = 0, pops = 0;
+
+    // Initialize edge cells, in memory order
+    for (int y = 0; y < ySize; y++)
+    {
+        for (int x = 0; x < xSize; x++)
+        {
+            int n = getIndex(x, y);
+            z = elev[n];
+            if (elev[n] == nodata)
+            {
+                processed[n] = true;
+                flowdir[n] = 255;
+            }
+            else
+            {
+                for (int d = 0; d < 8; d++)
+                {
+                    nx = getNeighbourX(x, d);
+                    ny = getNeighbourY(y, d);
+                    if ( !isInBounds(nx, ny) || elev[getIndex(nx, ny)] == nodata )
+                    {
+                        flowdir[n] = 255;
+                        queue.push(std::move(node(z, x, y)));
+                        queued[n] = true;
+                        pushes++;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    if (stats)
+        stats->addPhase("init", timer.lap());
+
+    // Flat filling raises cells to the level being processed, they are
+    // next whatever the queue holds. A FIFO takes them instead of the
+    // priority queue, so flats are swept outwards from their spill point
+    // in neighbourhood order rather than in heap order, at no heap cost
+    std::queue<node> flat;
+
+    // Large flats of a flat filling are flooded word by word instead, from
+    // the cells of the level queued so far
+    const size_t flatCells = 1024;
+    const bool wordFlats = !preserve && !links && !wrapX;
+    std::unique_ptr<CellBits> reached;
+    std::vector<node> seeds, boundary;
+
+    node current(0.0f, 0, 0);
+    while (!flat.empty() || !queue.empty())
+    {
+        if (wordFlats && flat.size() >= flatCells)
+        {
+            if (!reached)
+                reached.reset(new CellBits((size_t)xSize*ySize));
+            for (; !flat.empty(); flat.pop())
+            {
+                const node& seed = flat.front();
+                c = getIndex(seed.x, seed.y);
+                if (!flowdir[c])
+                    flowdir[c] = ldd[getFlowDir(seed.x, seed.y, seed.spill)];
+                seeds.push_back(seed);
+            }
+            floodFlat(elev, flowdir, xSize, ySize, seeds.front().spill, seeds, processed, queued, *reached, boundary);
+            for (const node& cell : boundary)
+                queue.push(cell);
+            pushes += boundary.size();
+            seeds.clear();
+            boundary.clear();
+            continue;
+        }
+        if (!flat.empty())
+        {
+            current = flat.front();
+            flat.pop();
+        }
+        else
+        {
+            current = queue.top();
+            queue.pop();
+            pops++;
+        }
+        c = getIndex(current.x, current.y);
+        processed[c] = true;
+        queued[c] = false;
+        z = current.spill;
+        for (int d = 0; d < 8; d++)
+        {
+            nx = getNeighbourX(current.x, d);
+            ny = getNeighbourY(current.y, d);
+            n = getIndex(nx, ny);
+            if ( isInBounds(nx, ny) && !queued[n])
+            {
+                nz = elev[n];
+                if ( !processed[n] ) // Compute the spill elevation of the neighbour
+                {
+                    if( preserve )
+					{
+						if( nz < (z + mindiff[d]) )
+							nz = z + mindiff[d];
+					}
+					else if( nz <= z )
+					{
+						nz = z;
+                        flowdir[n] = ldd[(d+4)%8];
+					}
+                    elev[n] = nz;
+
+                    if (nz == z)
+                    {
+                        flat.push(node(nz, nx, ny));
+                    }
+                    else
+                    {
+                        queue.push(std::move(node(nz, nx, ny)));
+                        pushes++;
+                    }
+                    queued[n] = true;
+                }
+            }
+        }
+        if (links && links->linked(c)) // The link is one more neighbour
+        {
+            n = links->partner(c);
+            if (!queued[n] && !processed[n])
+            {
+                nz = elev[n];
+                if( preserve )
+                {
+                    float linkdiff = minslope * getLinkLength(c);
+                    if( nz < (z + linkdiff) )
+                        nz = z + linkdiff;
+                }
+                else if( nz <= z )
+                {
+                    nz = z;
+                    flowdir[n] = linkFlow;
+                }
+                elev[n] = nz;
+
+                if (nz == z)
+                {
+                    flat.push(node(nz, n % xSize, n / xSize));
+                }
+                else
+                {
+                    queue.push(std::move(node(nz, n % xSize, n / xSize)));
+                    pushes++;
+                }
+                queued[n] = true;
+            }
+        }
+        if (!flowdir[c]) // Record the steepest gradient direction if needed
+        {
+            char d = getFlowDir(current.x, current.y, z);
+            flowdir[c] = d == linkDir ? linkFlow : ldd[d];
+        }
+    }
+    if (stats)
+    {
+        stats->addPhase("flood", timer.lap());
+        stats->pushes += pushes;
+        stats->pops += pops;
+    }
+}
+
+struct priorityflood
+{
+    float* elev;
+    unsigned char* flowdir;
+    int xSize, ySize;
+    const FillParams& params;
+    FillStats* stats;
+
+    template <class Queue>
+    void operator()(Queue& queue)
+    {
+        priorityFlood(elev, flowdir, xSize, ySize, params, queue, stats);
+    }
+};
+
+void fillPriorityFlood(float* elev, unsigned char* flowdir, int xSize, int ySize,
+                       const FillParams& params, FillStats* stats)
+{
+    priorityflood flood = { elev, flowdir, xSize, ySize, params, stats };
+    floodWithSelectedQueue(params, xSize, flood);
+}
@@ -0,0 +1,158 @@
+/***************************************************************
+#                         spillDEM core                        #
+****************************************************************
+#                                                              #
+#     Depression filling engines operating on in-memory        #
+#   elevation buffers. Shared by the spilldem command line     #
+#   tool and the spilldem_bench benchmark driver.              #
+#                                                              #
+***************************************************************/
+
+#ifndef SPILLDEM_FILL_H
+#define SPILLDEM_FILL_H
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "probes.h"
+#include "queues.h"
+
+class FlowLinks;
+class QueueTrace;
+
+struct node
+{
+    float spill;
+    int x;
+    int y;
+
+    node(float spill, int x, int y) 
+        : spill(spill), x(x), y(y)
+    {}
+
+    bool operator<(const node& rhs) const
+    {
+        return spill > rhs.spill;
+    }
+};
+
+struct dir
+{
+    int dx;
+    int dy;
+
+    dir(int dx, int dy)
+        : dx(dx), dy(dy)
+    {}
+};
+
+// D8 neighbourhood, in the order used by the flow direction codes below
+extern const std::array<dir, 8> ngh;
+// Flow direction code written for each neighbour index, 8 meaning "no direction"
+extern const std::array<unsigned char, 9> ldd;
+
+// Receives a finished tile of the tiled engines: the window
+// [x0, x0 + w) x [y0, y0 + h), rows w values apart. The buffers are only
+// valid during the call, which comes from the worker threads concurrently.
+typedef std::function<void(int x0, int y0, int w, int h, const float* elev, const unsigned char* flowdir)> TileSink;
+
+struct FillParams
+{
+    float minslope = 0.1f;      // minimum preserved slope gradient, in degrees
+    double nodata = -9999.0;
+    double pixelSizeX = 1.0;    // geotransform[1]
+    double pixelSizeY = -1.0;   // geotransform[5]
+    int threads = 1;            // worker threads, ignored by serial engines
+    int tileSize = 1024;        // tile side of the tiled engines
+    QueueKind queue = QueueKind::Binary;
+    QueueTrace* trace = nullptr; // records the queue operations when set
+    const TileSink* tileSink = nullptr; // tiled engines: called with every tile once final
+    const FlowLinks* links = nullptr; // pq engine: extra neighbour edges (culverts)
+    bool wrapX = false;         // pq and zhou engines: the east and west edges are neighbours
+};
+
+struct FillStats
+{
+    std::vector<std::pair<std::string, double>> phases; // wall time of each phase, in seconds
+    size_t pushes = 0;
+    size_t pops = 0;
+
+    void addPhase(const std::string& name, double seconds)
+    {
+        SPILLDEM_PROBE2(phase, name.c_str(), (long long)(seconds * 1e6));
+        phases.push_back(std::make_pair(name, seconds));
+    }
+
+    double total() const
+    {
+        double t = 0.0;
+        for (const auto& p : phases)
+            t += p.second;
+        return t;
+    }
+};
+
+class Timer
+{
+public:
+    Timer() : start(std::chrono::steady_clock::now()) {}
+
+    // Seconds since construction or the last call to lap()
+    double lap()
+    {
+        auto now = std::chrono::steady_clock::now();
+        double s = std::chrono::duration<double>(now - start).count();
+        start = now;
+        return s;
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+// Fill the depressions of elev in place and write the D8 flow direction
+// of every cell to flowdir (255 for outlets and nodata cells).
+typedef void (*FillFunction)(float* elev, unsigned char* flowdir, int xSize, int ySize,
+                             const FillParams& params, FillStats* stats);
+
+struct engine
+{
+    const char* name;
+    const char* description;
+    bool parallel;
+    bool gradient;  // supports minslope > 0
+    FillFunction fill;
+};
+
+const std::vector<engine>& fillEngines();
+const engine* findEngine(const std::string& name);
+
+// Wang & Liu spill elevation flood driven by the priority queue selected
+// in params. Follows params.links, cells draining through their link get
+// the linkFlow direction code. With params.wrapX, as for a global DEM,
+// the first and last columns are neighbours and only the north and south
+// edges drain out.
+void fillPriorityFlood(float* elev, unsigned char* flowdir, int xSize, int ySize,
+                       const FillParams& params, FillStats* stats = nullptr);
+
+// Priority flood with region growing of the cells that drain without being
+// raised (Zhou, Sun & Fu 2016)
+void fillRegionGrowing(float* elev, unsigned char* flowdir, int xSize, int ySize,
+                       const FillParams& params, FillStats* stats = nullptr);
+
+// Level-synchronous parallel flood: the cells of one spill elevation bucket
+// are expanded by all threads together, delta-stepping style. Flat filling
+// only, the filled DEM is the one of the pq engine.
+void fillLevelSynchronous(float* elev, unsigned char* flowdir, int xSize, int ySize,
+                          const FillParams& params, FillStats* stats = nullptr);
+
+// Parallel flood of the drainage basins of a coarse DEM, each on its own,
+// followed by a serial correction of the depressions spilling across basin
+// boundaries. Flat filling only, the filled DEM is the one of the pq engine.
+void fillWatershedPartitioned(float* elev, unsigned char* flowdir, int xSize, int ySize,
+                              const FillParams& params, FillStats* stats = nullptr);
+
+#endif
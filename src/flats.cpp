@@ -0,0 +1,213 @@
+#include <algorithm>
+#include "flats.h"
+
+// Occluded fills: every bit of gen spreads through the runs of pro it lies
+// in, towards the higher (fillUp) or lower (fillDown) bits
+static uint64_t fillUp(uint64_t gen, uint64_t pro)
+{
+    gen |= pro & (gen << 1);  pro &= pro << 1;
+    gen |= pro & (gen << 2);  pro &= pro << 2;
+    gen |= pro & (gen << 4);  pro &= pro << 4;
+    gen |= pro & (gen << 8);  pro &= pro << 8;
+    gen |= pro & (gen << 16); pro &= pro << 16;
+    gen |= pro & (gen << 32);
+    return gen;
+}
+
+static uint64_t fillDown(uint64_t gen, uint64_t pro)
+{
+    gen |= pro & (gen >> 1);  pro &= pro >> 1;
+    gen |= pro & (gen >> 2);  pro &= pro >> 2;
+    gen |= pro & (gen >> 4);  pro &= pro >> 4;
+    gen |= pro & (gen >> 8);  pro &= pro >> 8;
+    gen |= pro & (gen >> 16); pro &= pro >> 16;
+    gen |= pro & (gen >> 32);
+    return gen;
+}
+
+// Calls f(x0 + i) for every set bit i of bits
+template <class F>
+static void forEachBit(uint64_t bits, int x0, F f)
+{
+    while (bits)
+    {
+        f(x0 + __builtin_ctzll(bits));
+        bits &= bits - 1;
+    }
+}
+
+void floodFlat(float* elev, unsigned char* flowdir, int xSize, int ySize, float z,
+               const std::vector<node>& seeds, CellBits& processed, CellBits& queued,
+               CellBits& reached, std::vector<node>& boundary)
+{
+    // Rows are cut in words of 64 cells, word k holding x in [64k, 64k + 64)
+    const int words = (xSize + 63) / 64;
+    auto wordMask = [&](int k)
+    {
+        int n = std::min(64, xSize - 64 * k);
+        return n == 64 ? ~(uint64_t)0 : ((uint64_t)1 << n) - 1;
+    };
+    auto start = [&](int y, int k){ return (size_t)y * xSize + 64 * k; };
+    auto rowBits = [&](const CellBits& bits, int y, int k)
+    {
+        if (y < 0 || y >= ySize || k < 0 || k >= words)
+            return (uint64_t)0;
+        return bits.get64(start(y, k)) & wordMask(k);
+    };
+    // Cells of row y at or next to a set cell of row y
+    auto spread = [&](const CellBits& bits, int y, int k)
+    {
+        uint64_t w = rowBits(bits, y, k);
+        return w | w << 1 | w >> 1 | rowBits(bits, y, k - 1) >> 63 | rowBits(bits, y, k + 1) << 63;
+    };
+    auto candidates = [&](int y, int k)
+    {
+        size_t c0 = start(y, k);
+        int n = std::min(64, xSize - 64 * k);
+        uint64_t bits = 0;
+        for (int i = 0; i < n; i++)
+            bits |= (uint64_t)(elev[c0 + i] <= z) << i;
+        return bits & ~processed.get64(c0) & ~queued.get64(c0) & ~reached.get64(c0) & wordMask(k);
+    };
+
+    // Bounding box of the reached cells, in rows and words
+    int y0 = ySize, y1 = -1, k0 = words, k1 = -1;
+    auto extend = [&](int y, int k)
+    {
+        y0 = std::min(y0, y);
+        y1 = std::max(y1, y);
+        k0 = std::min(k0, k);
+        k1 = std::max(k1, k);
+    };
+    for (const node& seed : seeds)
+    {
+        reached[(size_t)seed.y * xSize + seed.x] = true;
+        extend(seed.y, seed.x / 64);
+    }
+
+    std::vector<uint64_t> pass(words), grow(words), up(words), down(words);
+
+    // Relax row y against the current state of its neighbour rows: the
+    // cells touching a reached cell, then the runs of candidates holding
+    // them. Every new cell drains to a cell reached before it, so the flow
+    // directions cannot loop.
+    auto relaxRow = [&](int y)
+    {
+        const int ka = std::max(0, k0 - 1), kb = std::min(words - 1, k1 + 1);
+        bool changed = false;
+        for (int k = ka; k <= kb; k++)
+        {
+            uint64_t r = rowBits(reached, y, k);
+            pass[k] = r | candidates(y, k);
+            grow[k] = r | (pass[k] & (spread(reached, y - 1, k) | spread(reached, y + 1, k)));
+        }
+        uint64_t carry = 0;
+        for (int k = ka; k <= kb; k++)
+        {
+            up[k] = fillUp(grow[k] | (carry & pass[k]), pass[k]);
+            carry = up[k] >> 63;
+        }
+        carry = 0;
+        for (int k = kb; k >= ka; k--)
+        {
+            down[k] = fillDown(grow[k] | (carry << 63 & pass[k]), pass[k]);
+            carry = down[k] & 1;
+        }
+        for (int k = ka; k <= kb; k++)
+        {
+            uint64_t r = rowBits(reached, y, k);
+            up[k] = (up[k] | down[k]) & ~r; // new cells
+            // Next to a cell reached before: drain to it
+            grow[k] = up[k] & (spread(reached, y - 1, k) | spread(reached, y + 1, k) | spread(reached, y, k));
+            forEachBit(grow[k], 64 * k, [&](int x)
+            {
+                for (int d = 0; d < 8; d++)
+                {
+                    int nx = x + ngh[d].dx, ny = y + ngh[d].dy;
+                    if (nx >= 0 && nx < xSize && ny >= 0 && ny < ySize && reached[(size_t)ny * xSize + nx])
+                    {
+                        flowdir[(size_t)y * xSize + x] = ldd[d];
+                        break;
+                    }
+                }
+            });
+        }
+        // The others were reached along the row: drain left to the cells
+        // grown rightwards from a drained cell, then right to the rest
+        carry = 0;
+        for (int k = ka; k <= kb; k++)
+        {
+            uint64_t rightwards = fillUp(grow[k] | (carry & up[k]), up[k]);
+            carry = rightwards >> 63;
+            pass[k] = rightwards;
+            forEachBit(rightwards & ~grow[k], 64 * k, [&](int x){ flowdir[(size_t)y * xSize + x] = ldd[4]; });
+        }
+        carry = 0;
+        for (int k = kb; k >= ka; k--)
+        {
+            uint64_t leftwards = fillDown(pass[k] | (carry << 63 & up[k]), up[k]);
+            carry = leftwards & 1;
+            forEachBit(leftwards & ~pass[k], 64 * k, [&](int x){ flowdir[(size_t)y * xSize + x] = ldd[0]; });
+        }
+        for (int k = ka; k <= kb; k++)
+        {
+            if (up[k])
+            {
+                reached.set64(start(y, k), up[k]);
+                extend(y, k);
+                changed = true;
+            }
+        }
+        return changed;
+    };
+
+    // Sweep down and up until a sweep reaches nothing new, the bounding
+    // box grows along with the sweep
+    for (bool downwards = true; ; downwards = !downwards)
+    {
+        bool changed = false;
+        if (downwards)
+        {
+            for (int y = std::max(0, y0 - 1); y <= std::min(ySize - 1, y1 + 1); y++)
+                changed = relaxRow(y) || changed;
+        }
+        else
+        {
+            for (int y = std::min(ySize - 1, y1 + 1); y >= std::max(0, y0 - 1); y--)
+                changed = relaxRow(y) || changed;
+        }
+        if (!changed)
+            break;
+    }
+
+    // The flooded cells are done, their outer neighbours go to the queue
+    for (int y = std::max(0, y0 - 1); y <= std::min(ySize - 1, y1 + 1); y++)
+    {
+        for (int k = std::max(0, k0 - 1); k <= std::min(words - 1, k1 + 1); k++)
+        {
+            size_t c0 = start(y, k);
+            uint64_t around = (spread(reached, y - 1, k) | spread(reached, y, k) | spread(reached, y + 1, k))
+                            & ~rowBits(reached, y, k) & ~processed.get64(c0) & ~queued.get64(c0) & wordMask(k);
+            forEachBit(around, 64 * k, [&](int x)
+            {
+                size_t c = (size_t)y * xSize + x;
+                queued[c] = true;
+                boundary.push_back(node(elev[c], x, y));
+            });
+        }
+    }
+    for (int y = y0; y <= y1; y++)
+    {
+        for (int k = k0; k <= k1; k++)
+        {
+            forEachBit(rowBits(reached, y, k), 64 * k, [&](int x)
+            {
+                size_t c = (size_t)y * xSize + x;
+                elev[c] = z;
+                processed[c] = true;
+                queued[c] = false;
+                reached[c] = false;
+            });
+        }
+    }
+}
@@ -0,0 +1,81 @@
+/***************************************************************
+#                    spillDEM flat flooding                    #
+****************************************************************
+#                                                              #
+#     A depression filled flat is raised to a single level,    #
+#   so flooding it is a connectivity problem: which cells at   #
+#   or below the level join the cells already raised. It is    #
+#   solved here 64 cells at a time with word operations over   #
+#   the state bitmaps, sweeping the rows down and up until     #
+#   nothing changes, instead of one queue operation per cell.  #
+#                                                              #
+***************************************************************/
+
+#ifndef SPILLDEM_FLATS_H
+#define SPILLDEM_FLATS_H
+
+#include <cstdint>
+#include <vector>
+#include "fill.h"
+
+// One bit per cell in raster order, like std::vector<bool>, but any 64
+// consecutive cells can be read or set as a word
+class CellBits
+{
+public:
+    class reference
+    {
+    public:
+        reference(uint64_t& word, uint64_t mask) : word(word), mask(mask) {}
+        operator bool() const { return (word & mask) != 0; }
+        reference& operator=(bool value)
+        {
+            word = value ? word | mask : word & ~mask;
+            return *this;
+        }
+
+    private:
+        uint64_t& word;
+        uint64_t mask;
+    };
+
+    CellBits(size_t size) : words((size + 63) / 64 + 1, 0) {}
+
+    bool operator[](size_t c) const { return (words[c >> 6] >> (c & 63)) & 1; }
+    reference operator[](size_t c) { return reference(words[c >> 6], (uint64_t)1 << (c & 63)); }
+
+    // Cells [c, c + 64), bit i for cell c + i
+    uint64_t get64(size_t c) const
+    {
+        size_t w = c >> 6;
+        unsigned s = c & 63;
+        return s ? words[w] >> s | words[w + 1] << (64 - s) : words[w];
+    }
+
+    void set64(size_t c, uint64_t bits)
+    {
+        size_t w = c >> 6;
+        unsigned s = c & 63;
+        words[w] |= bits << s;
+        if (s)
+            words[w + 1] |= bits >> (64 - s);
+    }
+
+private:
+    std::vector<uint64_t> words; // one spare word so that get64 can always read the next
+};
+
+// Flood the flat at level z of a flat filling (minslope 0) from seeds,
+// cells already raised to z and queued, with their flow direction set.
+// The cells at or below z, neither processed nor queued, 8-connected to
+// the seeds through such cells are raised to z and get flow directions
+// leading back to the seeds. Seeds and flooded cells are marked processed.
+// The unprocessed and unqueued cells around them are appended to boundary
+// and marked queued, for the caller to push at their own elevation.
+//
+// reached is scratch space of the raster size, clear on entry and on exit.
+void floodFlat(float* elev, unsigned char* flowdir, int xSize, int ySize, float z,
+               const std::vector<node>& seeds, CellBits& processed, CellBits& queued,
+               CellBits& reached, std::vector<node>& boundary);
+
+#endif
@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include "gdalio.h"
+#include "probes.h"
+
+GDALDataset* createOutput(GDALDriver* driver, const std::string& path, int xSize, int ySize,
+                          GDALDataType type, GDALDataset* srcDataset, const double* geoTransform,
+                          double nodata, const OutputLayout& layout)
+{
+    char** options = nullptr;
+    if (layout.tiled)
+        options = CSLSetNameValue(options, "TILED", "YES");
+    if (layout.blockSize > 0)
+    {
+        std::string size = std::to_string(layout.blockSize);
+        if (layout.tiled)
+            options = CSLSetNameValue(options, "BLOCKXSIZE", size.c_str());
+        options = CSLSetNameValue(options, "BLOCKYSIZE", size.c_str());
+    }
+    if (!layout.compress.empty())
+        options = CSLSetNameValue(options, "COMPRESS", layout.compress.c_str());
+    if (layout.maxZError > 0.0)
+        options = CSLSetNameValue(options, "MAX_Z_ERROR", CPLSPrintf("%.17g", layout.maxZError));
+    if (layout.threads > 0)
+        options = CSLSetNameValue(options, "NUM_THREADS", std::to_string(layout.threads).c_str());
+    GDALDataset *dataset = driver->Create(path.c_str(), xSize, ySize, 1, type, options);
+    CSLDestroy(options);
+    if ( dataset == nullptr )
+    {
+        fprintf(stderr, "Error: Cannot create %s\n", path.c_str());
+        return nullptr;
+    }
+    double adfGeoTransform[6];
+    std::copy(geoTransform, geoTransform + 6, adfGeoTransform);
+    dataset->SetGeoTransform(adfGeoTransform);
+    dataset->SetSpatialRef(srcDataset->GetSpatialRef());
+    dataset->GetRasterBand(1)->SetNoDataValue(nodata);
+    return dataset;
+}
+
+bool rasterWindow(GDALRasterBand* band, GDALRWFlag rw, int x0, int y0, int w, int h, void* data,
+                  GDALDataType type, GSpacing lineSpace)
+{
+    SPILLDEM_PROBE5(io__start, rw == GF_Write, x0, y0, w, h);
+    bool ok = band->RasterIO(rw, x0, y0, w, h, data, w, h, type, 0, lineSpace) == CE_None;
+    SPILLDEM_PROBE2(io__end, rw == GF_Write, ok);
+    return ok;
+}
+
+bool readRaster(GDALRasterBand* band, float* elev)
+{
+    const int xSize = band->GetXSize(), ySize = band->GetYSize();
+    return rasterWindow(band, GF_Read, 0, 0, xSize, ySize, elev, GDT_Float32);
+}
+
+bool writeRaster(GDALRasterBand* band, const void* data, GDALDataType type)
+{
+    const int xSize = band->GetXSize(), ySize = band->GetYSize();
+    return rasterWindow(band, GF_Write, 0, 0, xSize, ySize, (void*)data, type);
+}
+
+// Calls f(x0, y0, w, h) for every block of band, in row major order
+template <class F>
+static void forEachBlock(GDALRasterBand* band, F f)
+{
+    const int xSize = band->GetXSize(), ySize = band->GetYSize();
+    int bx, by;
+    band->GetBlockSize(&bx, &by);
+    for (int y0 = 0; y0 < ySize; y0 += by)
+    {
+        for (int x0 = 0; x0 < xSize; x0 += bx)
+            f(x0, y0, std::min(bx, xSize - x0), std::min(by, ySize - y0));
+    }
+}
+
+std::vector<uint64_t> blockChecksums(GDALRasterBand* band, const float* data)
+{
+    const size_t xSize = band->GetXSize();
+    std::vector<uint64_t> sums;
+    forEachBlock(band, [&](int x0, int y0, int w, int h)
+    {
+        // FNV-1a over the bit patterns
+        uint64_t hash = 14695981039346656037ULL;
+        for (int y = y0; y < y0 + h; y++)
+        {
+            const float* row = data + y * xSize + x0;
+            for (int x = 0; x < w; x++)
+            {
+                uint32_t bits;
+                std::memcpy(&bits, row + x, sizeof(bits));
+                hash = (hash ^ bits) * 1099511628211ULL;
+            }
+        }
+        sums.push_back(hash);
+    });
+    return sums;
+}
+
+bool writeChangedBlocks(GDALRasterBand* band, const float* data, const std::vector<uint64_t>& before,
+                        size_t& written)
+{
+    const size_t xSize = band->GetXSize();
+    std::vector<uint64_t> after = blockChecksums(band, data);
+    size_t b = 0;
+    bool ok = after.size() == before.size();
+    written = 0;
+    forEachBlock(band, [&](int x0, int y0, int w, int h)
+    {
+        if (ok && after[b] != before[b])
+        {
+            ok = rasterWindow(band, GF_Write, x0, y0, w, h, (void*)(data + y0 * xSize + x0), GDT_Float32,
+                              xSize * sizeof(float));
+            written++;
+        }
+        b++;
+    });
+    return ok;
+}
+
+bool ElevationStorage::fitRange(double minimum, double maximum)
+{
+    if (encoding != Quantized)
+        return true;
+    // Rounding to the nearest step keeps the error within half a step
+    scale = 2.0 * tolerance;
+    offset = (minimum + maximum) / 2.0;
+    double half = std::ceil((maximum - minimum) / 2.0 / scale);
+    if (half <= SHRT_MAX)
+        type = GDT_Int16;
+    else if (half <= INT_MAX)
+        type = GDT_Int32;
+    else
+        return false;
+    return true;
+}
+
+static double integerNodata(GDALDataType type)
+{
+    return type == GDT_Int16 ? SHRT_MIN : INT_MIN;
+}
+
+GDALDataset* createElevationOutput(GDALDriver* driver, const std::string& path, int xSize, int ySize,
+                                   GDALDataset* srcDataset, const double* geoTransform, double nodata,
+                                   const ElevationStorage& storage)
+{
+    OutputLayout layout;
+    if (storage.encoding == ElevationStorage::Lerc)
+    {
+        layout.compress = "LERC";
+        layout.maxZError = storage.tolerance;
+    }
+    if (storage.encoding != ElevationStorage::Quantized)
+        return createOutput(driver, path, xSize, ySize, GDT_Float32, srcDataset, geoTransform, nodata, layout);
+
+    GDALDataset* dataset = createOutput(driver, path, xSize, ySize, storage.type, srcDataset, geoTransform,
+                                        integerNodata(storage.type), layout);
+    if (dataset != nullptr)
+    {
+        dataset->GetRasterBand(1)->SetScale(storage.scale);
+        dataset->GetRasterBand(1)->SetOffset(storage.offset);
+    }
+    return dataset;
+}
+
+bool writeElevation(GDALRasterBand* band, int x0, int y0, int w, int h, const float* elev, float nodata,
+                    const ElevationStorage& storage)
+{
+    if (storage.encoding != ElevationStorage::Quantized)
+        return rasterWindow(band, GF_Write, x0, y0, w, h, (void*)elev, GDT_Float32);
+
+    // Converted a few rows at a time, GDAL narrows Int32 to the band type
+    const int rows = std::max(1, std::min(h, (1 << 20) / std::max(1, w)));
+    const int32_t missing = (int32_t)integerNodata(storage.type);
+    std::vector<int32_t> buffer((size_t)w * rows);
+    for (int y = 0; y < h; y += rows)
+    {
+        const int n = std::min(rows, h - y);
+        const float* src = elev + (size_t)y * w;
+        for (size_t i = 0; i < (size_t)w * n; i++)
+            buffer[i] = src[i] == nodata ? missing : (int32_t)std::lround((src[i] - storage.offset) / storage.scale);
+        if (!rasterWindow(band, GF_Write, x0, y0 + y, w, n, buffer.data(), GDT_Int32))
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,82 @@
+/***************************************************************
+#                       spillDEM raster I/O                    #
+****************************************************************
+#                                                              #
+#     GDAL reads and writes of whole rasters, shared by the    #
+#   spilldem tool and the spilldem_iobench benchmark so that   #
+#   the benchmark measures the code paths the tool runs.       #
+#                                                              #
+***************************************************************/
+
+#ifndef SPILLDEM_GDALIO_H
+#define SPILLDEM_GDALIO_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "gdal_priv.h"
+
+// GeoTIFF layout of an output
+struct OutputLayout
+{
+    bool tiled = false;        // square tiles rather than strips
+    int blockSize = 0;         // tile side, or strip height in rows; 0 for the driver default
+    std::string compress = ""; // COMPRESS creation option, empty for none
+    int threads = 0;           // NUM_THREADS of the compression, 0 for the driver default
+    double maxZError = 0.0;    // MAX_Z_ERROR of LERC compression
+};
+
+// How the filled DEM is stored. Both lossy encodings keep every value
+// within tolerance of the computed elevation.
+struct ElevationStorage
+{
+    enum Encoding { Float, Lerc, Quantized };
+    Encoding encoding = Float;
+    double tolerance = 0.0;
+
+    // Quantized values are offset + scale * stored, set by fitRange
+    GDALDataType type = GDT_Float32;
+    double scale = 1.0;
+    double offset = 0.0;
+
+    // Pick the integer type and offset for values in [minimum, maximum],
+    // false when even Int32 cannot hold them at this tolerance
+    bool fitRange(double minimum, double maximum);
+};
+
+// New single band output georeferenced like srcDataset with geoTransform
+GDALDataset* createOutput(GDALDriver* driver, const std::string& path, int xSize, int ySize,
+                          GDALDataType type, GDALDataset* srcDataset, const double* geoTransform,
+                          double nodata, const OutputLayout& layout = OutputLayout());
+
+// Filled DEM output, encoded as storage says
+GDALDataset* createElevationOutput(GDALDriver* driver, const std::string& path, int xSize, int ySize,
+                                   GDALDataset* srcDataset, const double* geoTransform, double nodata,
+                                   const ElevationStorage& storage);
+// Write the window [x0, x0 + w) x [y0, y0 + h) of a filled DEM output
+bool writeElevation(GDALRasterBand* band, int x0, int y0, int w, int h, const float* elev, float nodata,
+                    const ElevationStorage& storage);
+
+// Window [x0, x0 + w) x [y0, y0 + h) of band read into or written from a
+// buffer of the given type, rows w values apart unless lineSpace, in bytes,
+// is given. All the raster I/O goes through here, between the io__start
+// and io__end probes.
+bool rasterWindow(GDALRasterBand* band, GDALRWFlag rw, int x0, int y0, int w, int h, void* data,
+                  GDALDataType type, GSpacing lineSpace = 0);
+
+// Whole band as Float32
+bool readRaster(GDALRasterBand* band, float* elev);
+// Whole band from a buffer of the given type
+bool writeRaster(GDALRasterBand* band, const void* data, GDALDataType type);
+
+// Checksum of every block of band over the whole band data held in memory,
+// blocks in row major order. Taken before and after modifying data, they
+// tell the blocks to write back without keeping a copy of the original.
+std::vector<uint64_t> blockChecksums(GDALRasterBand* band, const float* data);
+// Write the blocks of data whose checksum differs from before, counting
+// them in written. The untouched cells of those blocks are written back
+// from data too, so the band type must hold Float32 values exactly.
+bool writeChangedBlocks(GDALRasterBand* band, const float* data, const std::vector<uint64_t>& before,
+                        size_t& written);
+
+#endif
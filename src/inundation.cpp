@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cmath>
+#include "inundation.h"
+#include "trace.h"
+
+template <class Queue>
+static void connectedFlood(const float* elev, const unsigned char* ocean, int xSize, int ySize,
+                           const FillParams& params, Queue& queue, float* threshold, FillStats* stats)
+{
+    Timer timer;
+    const float nodata = params.nodata;
+
+    auto getIndex = [&](int x, int y){ return (size_t)y * xSize + x; };
+    auto isInBounds = [&](int x, int y){ return x >= 0 && x < xSize && y >= 0 && y < ySize; };
+    auto isOutlet = [&](int x, int y)
+    {
+        for (int d = 0; d < 8; d++)
+        {
+            int nx = x + ngh[d].dx, ny = y + ngh[d].dy;
+            if (!isInBounds(nx, ny) || elev[getIndex(nx, ny)] == nodata)
+                return true;
+        }
+        return false;
+    };
+
+    std::vector<bool> queued((size_t)xSize * ySize, false);
+    std::fill(threshold, threshold + (size_t)xSize * ySize, nodata);
+    size_t pushes = 0, pops = 0;
+
+    // Nodata ocean cells have no level of their own, they connect their
+    // neighbours at any level
+    for (int y = 0; y < ySize; y++)
+    {
+        for (int x = 0; x < xSize; x++)
+        {
+            size_t c = getIndex(x, y);
+            bool seed = ocean ? ocean[c] != 0 : elev[c] != nodata && isOutlet(x, y);
+            if (seed)
+            {
+                queue.push(node(elev[c] == nodata ? -INFINITY : elev[c], x, y));
+                queued[c] = true;
+                pushes++;
+            }
+        }
+    }
+    if (stats)
+        stats->addPhase("init", timer.lap());
+
+    while (!queue.empty())
+    {
+        node current = queue.top();
+        queue.pop();
+        pops++;
+        float z = current.spill;
+        if (elev[getIndex(current.x, current.y)] != nodata)
+            threshold[getIndex(current.x, current.y)] = z;
+        for (int d = 0; d < 8; d++)
+        {
+            int nx = current.x + ngh[d].dx, ny = current.y + ngh[d].dy;
+            if (!isInBounds(nx, ny))
+                continue;
+            size_t n = getIndex(nx, ny);
+            if (queued[n] || elev[n] == nodata)
+                continue;
+            queue.push(node(std::max(elev[n], z), nx, ny));
+            queued[n] = true;
+            pushes++;
+        }
+    }
+    if (stats)
+    {
+        stats->addPhase("flood", timer.lap());
+        stats->pushes += pushes;
+        stats->pops += pops;
+    }
+}
+
+struct connectedflood
+{
+    const float* elev;
+    const unsigned char* ocean;
+    int xSize, ySize;
+    const FillParams& params;
+    float* threshold;
+    FillStats* stats;
+
+    template <class Queue>
+    void operator()(Queue& queue)
+    {
+        connectedFlood(elev, ocean, xSize, ySize, params, queue, threshold, stats);
+    }
+};
+
+void inundationThreshold(const float* elev, const unsigned char* ocean, int xSize, int ySize,
+                         const FillParams& params, float* threshold, FillStats* stats)
+{
+    connectedflood flood = { elev, ocean, xSize, ySize, params, threshold, stats };
+    floodWithSelectedQueue(params, xSize, flood);
+}
@@ -0,0 +1,28 @@
+/***************************************************************
+#                 spillDEM inundation threshold                #
+****************************************************************
+#                                                              #
+#     Connected ("bathtub") flooding at every water level in   #
+#   one pass: flooded from the ocean, the spill elevation of   #
+#   a cell is the lowest water level at which it is connected  #
+#   to the ocean and thus inundated.                           #
+#                                                              #
+***************************************************************/
+
+#ifndef SPILLDEM_INUNDATION_H
+#define SPILLDEM_INUNDATION_H
+
+#include "fill.h"
+
+// Water level at which every cell becomes connected-inundated: a cell is
+// flooded at level h if a D8 path of cells no higher than h joins it to an
+// ocean cell. Ocean cells are the non zero cells of ocean, they may be
+// nodata in elev; without ocean, the cells at the raster edge or next to
+// nodata are the ocean, as for filling.
+//
+// Ocean cells with an elevation get their own elevation, other nodata
+// cells and cells not connected to the ocean get nodata.
+void inundationThreshold(const float* elev, const unsigned char* ocean, int xSize, int ySize,
+                         const FillParams& params, float* threshold, FillStats* stats = nullptr);
+
+#endif
@@ -0,0 +1,336 @@
+/***************************************************************
+#                     spillDEM I/O benchmarks                  #
+****************************************************************
+#                                                              #
+#     Read and write throughput of the GeoTIFF layouts the     #
+#   spilldem outputs may use: strips or tiles, block size,     #
+#   compression and compression threads. Goes through the same #
+#   createOutput/readRaster/writeRaster calls as spilldem, on  #
+#   a generated DEM and its flow directions.                   #
+#                                                              #
+***************************************************************/
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "gdal_priv.h"
+#include "cpl_conv.h"
+
+#include "SpillDEM.h" // config file
+#include "fill.h"
+#include "gdalio.h"
+#include "synthetic.h"
+#include "sysinfo.h"
+
+static void usage(const char* name)
+{
+    printf("%s version %d.%d\n"
+           "usage: %s <options>\n"
+           "Options:\n"
+            "\t-o, --output        CSV output file (default io.csv)\n"
+            "\t-d, --directory     directory of the test files, on the storage to measure (default .)\n"
+            "\t-n, --size          raster side (default 4096)\n"
+            "\t-l, --layouts       comma separated layouts: strip, tile (default both)\n"
+            "\t-b, --blocks        comma separated tile sides; strips hold as many cells as a tile\n"
+            "\t                    (default 128,256,512)\n"
+            "\t-c, --compress      comma separated compressions (default NONE,DEFLATE,ZSTD,LERC)\n"
+            "\t-t, --threads       comma separated compression thread counts (default 1,2,4,... up to\n"
+            "\t                    the available CPUs)\n"
+            "\t-r, --repeat        runs per configuration, the median is reported (default 3)\n"
+            "\t-v, --verbose       display every measure\n"
+            "\n"
+            "\t-h, --help          display this message and exit\n",
+            name, SpillDEM_VERSION_MAJOR, SpillDEM_VERSION_MINOR, name);
+}
+
+static std::vector<std::string> splitList(const char* arg)
+{
+    std::vector<std::string> values;
+    std::string item;
+    for (const char* p = arg; ; p++)
+    {
+        if (*p == ',' || *p == '\0')
+        {
+            if (!item.empty())
+                values.push_back(item);
+            item.clear();
+            if (*p == '\0')
+                break;
+        }
+        else
+        {
+            item += *p;
+        }
+    }
+    return values;
+}
+
+static std::vector<int> parseList(const char* arg)
+{
+    std::vector<int> values;
+    for (const std::string& item : splitList(arg))
+    {
+        int v = std::atoi(item.c_str());
+        if (v <= 0)
+            return std::vector<int>();
+        values.push_back(v);
+    }
+    return values;
+}
+
+static double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+struct measure
+{
+    double write = 0.0; // seconds, closing the dataset and syncing it to storage included
+    double read = 0.0;  // seconds, 0 when not measured
+    double bytes = 0.0; // file size
+};
+
+// Flush the file to the storage, so that the write is not timed against the
+// page cache, and when evict is set drop it from the cache so that a read
+// back comes from the storage too
+static bool syncFile(const std::string& path, bool evict)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool ok = fsync(fd) == 0 && (!evict || posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0);
+    close(fd);
+    return ok;
+}
+
+// Write data as a new raster with the given layout, then read it back when
+// asked, the way spilldem reads its input
+static bool runOnce(GDALDriver* driver, GDALDataset* reference, const std::string& path, int side,
+                    GDALDataType type, const void* data, const OutputLayout& layout, bool read, measure& out)
+{
+    const double geoTransform[6] = { 0.0, 1.0, 0.0, 0.0, 0.0, -1.0 };
+    Timer timer;
+    GDALDataset* dataset = createOutput(driver, path, side, side, type, reference, geoTransform,
+                                        type == GDT_Byte ? 255 : -9999, layout);
+    if (dataset == nullptr)
+        return false;
+    bool ok = writeRaster(dataset->GetRasterBand(1), data, type);
+    GDALClose(dataset);
+    ok = syncFile(path, false) && ok;
+    out.write = timer.lap();
+
+    struct stat st;
+    out.bytes = stat(path.c_str(), &st) == 0 ? (double)st.st_size : 0.0;
+    if (ok && read)
+    {
+        std::vector<float> buffer((size_t)side * side);
+        ok = syncFile(path, true);
+        timer.lap();
+        dataset = (GDALDataset*)GDALOpen(path.c_str(), GA_ReadOnly);
+        ok = dataset != nullptr && readRaster(dataset->GetRasterBand(1), buffer.data());
+        if (dataset != nullptr)
+            GDALClose(dataset);
+        out.read = timer.lap();
+    }
+    unlink(path.c_str());
+    return ok;
+}
+
+int main(int argc, char* argv[])
+{
+    const option long_opts[] =
+    {
+        {"output", required_argument, nullptr, 'o'},
+        {"directory", required_argument, nullptr, 'd'},
+        {"size", required_argument, nullptr, 'n'},
+        {"layouts", required_argument, nullptr, 'l'},
+        {"blocks", required_argument, nullptr, 'b'},
+        {"compress", required_argument, nullptr, 'c'},
+        {"threads", required_argument, nullptr, 't'},
+        {"repeat", required_argument, nullptr, 'r'},
+        {"verbose", no_argument, nullptr, 'v'},
+        {"help", no_argument, nullptr, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    bool verbose = false;
+    std::string outfile = "io.csv";
+    std::string directory = ".";
+    int size = 4096, repeat = 3;
+    std::vector<std::string> layouts = { "strip", "tile" };
+    std::vector<int> blocks = { 128, 256, 512 };
+    std::vector<std::string> compressions = { "NONE", "DEFLATE", "ZSTD", "LERC" };
+    std::vector<int> threads;
+    while ((opt = getopt_long(argc, argv, ":o:d:n:l:b:c:t:r:vh", long_opts, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+        case 'o':
+            outfile = std::string(optarg);
+            break;
+        case 'd':
+            directory = std::string(optarg);
+            break;
+        case 'n':
+            size = std::atoi(optarg);
+            break;
+        case 'l':
+            layouts = splitList(optarg);
+            for (const std::string& l : layouts)
+            {
+                if (l != "strip" && l != "tile")
+                {
+                    fprintf(stderr, "Error: Unknown layout '%s'\n", l.c_str());
+                    exit(EXIT_FAILURE);
+                }
+            }
+            break;
+        case 'b':
+            blocks = parseList(optarg);
+            break;
+        case 'c':
+            compressions = splitList(optarg);
+            break;
+        case 't':
+            threads = parseList(optarg);
+            break;
+        case 'r':
+            repeat = std::max(1, std::atoi(optarg));
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+            break;
+        case '?':
+            usage(argv[0]);
+            fprintf(stderr, "Error: Unknown option -%c\n", (char)optopt);
+            exit(EXIT_FAILURE);
+            break;
+        case ':':
+            usage(argv[0]);
+            fprintf(stderr, "Error: Option -%c requires an argument\n", (char)optopt);
+            exit(EXIT_FAILURE);
+            break;
+        }
+    }
+    if (size <= 0 || blocks.empty() || compressions.empty() || layouts.empty())
+    {
+        usage(argv[0]);
+        fprintf(stderr, "Error: Invalid size or empty list\n");
+        exit(EXIT_FAILURE);
+    }
+    if (threads.empty())
+    {
+        int cores = availableCpus();
+        for (int t = 1; t < cores; t *= 2)
+            threads.push_back(t);
+        threads.push_back(cores);
+    }
+
+    GDALAllRegister();
+    GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+    if (driver == nullptr)
+        exit(EXIT_FAILURE);
+    // Blocks must go to the file, not stay in the cache
+    GDALSetCacheMax64(64 << 20);
+
+    // The rasters spilldem writes: a DEM and its flow directions
+    std::vector<float> elev((size_t)size * size);
+    std::vector<unsigned char> flowdir((size_t)size * size);
+    generateDEM(elev.data(), size, size, 42);
+    FillParams params;
+    params.minslope = 0.0f;
+    findEngine("pq")->fill(elev.data(), flowdir.data(), size, size, params, nullptr);
+    GDALDataset* reference = driver->Create((directory + "/spilldem_io_ref.tif").c_str(), 1, 1, 1, GDT_Byte, nullptr);
+    if (reference == nullptr)
+    {
+        fprintf(stderr, "Error: Cannot write to %s\n", directory.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    FILE* csv = fopen(outfile.c_str(), "w");
+    if (csv == nullptr)
+    {
+        fprintf(stderr, "Error: Cannot open %s\n", outfile.c_str());
+        exit(EXIT_FAILURE);
+    }
+    fprintf(csv, "raster,layout,block,compress,threads,write_s,write_mb_per_s,read_s,read_mb_per_s,file_mb,ratio\n");
+    const std::string path = directory + "/spilldem_io_test.tif";
+    int status = EXIT_SUCCESS;
+    for (const std::string& compress : compressions)
+    {
+        for (const std::string& l : layouts)
+        {
+            for (int block : blocks)
+            {
+                for (int t : threads)
+                {
+                    // Uncompressed data does not use the threads
+                    if (compress == "NONE" && t != threads.front())
+                        continue;
+                    OutputLayout layout;
+                    layout.tiled = l == "tile";
+                    layout.blockSize = layout.tiled ? block : std::max(1, (int)((double)block * block / size));
+                    layout.compress = compress == "NONE" ? "" : compress;
+                    layout.threads = t;
+                    CPLSetConfigOption("GDAL_NUM_THREADS", std::to_string(t).c_str());
+                    for (int r = 0; r < 2; r++)
+                    {
+                        const bool isElev = r == 0;
+                        const double raw = (double)size * size * (isElev ? sizeof(float) : 1);
+                        std::vector<double> writes, reads;
+                        measure m;
+                        bool ok = true;
+                        for (int i = 0; i < repeat && ok; i++)
+                        {
+                            ok = runOnce(driver, reference, path, size, isElev ? GDT_Float32 : GDT_Byte,
+                                         isElev ? (const void*)elev.data() : (const void*)flowdir.data(),
+                                         layout, isElev, m);
+                            writes.push_back(m.write);
+                            reads.push_back(m.read);
+                        }
+                        if (!ok)
+                        {
+                            fprintf(stderr, "Warning: %s %s %d %s failed, skipped\n", isElev ? "elev" : "flow",
+                                    l.c_str(), block, compress.c_str());
+                            status = EXIT_FAILURE;
+                            continue;
+                        }
+                        double write = median(writes), read = median(reads);
+                        fprintf(csv, "%s,%s,%d,%s,%d,%.6f,%.1f,", isElev ? "elev" : "flow", l.c_str(),
+                                layout.blockSize, compress.c_str(), t, write, raw / write / 1048576);
+                        if (isElev)
+                            fprintf(csv, "%.6f,%.1f,", read, raw / read / 1048576);
+                        else
+                            fprintf(csv, ",,");
+                        fprintf(csv, "%.2f,%.3f\n", m.bytes / 1048576, m.bytes > 0 ? raw / m.bytes : 0.0);
+                        if (verbose)
+                        {
+                            printf("%-4s %-5s %4d %-7s %2d threads: write %8.1f MB/s", isElev ? "elev" : "flow",
+                                   l.c_str(), layout.blockSize, compress.c_str(), t, raw / write / 1048576);
+                            if (isElev)
+                                printf(", read %8.1f MB/s", raw / read / 1048576);
+                            printf(", ratio %.2f\n", m.bytes > 0 ? raw / m.bytes : 0.0);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    fclose(csv);
+    GDALClose(reference);
+    unlink((directory + "/spilldem_io_ref.tif").c_str());
+    exit(status);
+}
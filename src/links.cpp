@@ -0,0 +1,78 @@
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include "links.h"
+
+FlowLinks::FlowLinks(int xSize, int ySize)
+    : xSize(xSize), ySize(ySize)
+{}
+
+bool FlowLinks::add(int x0, int y0, int x1, int y1)
+{
+    auto isInBounds = [&](int x, int y){ return x >= 0 && x < xSize && y >= 0 && y < ySize; };
+    if (!isInBounds(x0, y0) || !isInBounds(x1, y1) || (x0 == x1 && y0 == y1))
+        return false;
+    size_t a = (size_t)y0 * xSize + x0, b = (size_t)y1 * xSize + x1;
+    if (linked(a) || linked(b))
+        return false;
+    if (marks.empty())
+        marks.resize((size_t)xSize * ySize, false);
+    marks[a] = marks[b] = true;
+    partners[a] = b;
+    partners[b] = a;
+    return true;
+}
+
+double FlowLinks::length(size_t c, double pixelSizeX, double pixelSizeY) const
+{
+    size_t p = partner(c);
+    double dx = ((long)(p % xSize) - (long)(c % xSize)) * pixelSizeX;
+    double dy = ((long)(p / xSize) - (long)(c / xSize)) * pixelSizeY;
+    return std::sqrt(dx * dx + dy * dy);
+}
+
+bool readFlowLinks(const std::string& path, const double* geoTransform, FlowLinks& links, std::string& error)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+    auto toCell = [&](double x, double y, int& col, int& row)
+    {
+        col = (int)std::floor((x - geoTransform[0]) / geoTransform[1]);
+        row = (int)std::floor((y - geoTransform[3]) / geoTransform[5]);
+    };
+    std::string line;
+    for (int number = 1; std::getline(in, line); number++)
+    {
+        for (char& ch : line)
+        {
+            if (ch == ',')
+                ch = ' ';
+        }
+        std::istringstream fields(line);
+        std::string first;
+        if (!(fields >> first) || first[0] == '#')
+            continue;
+        fields.clear();
+        fields.seekg(0);
+        double x0, y0, x1, y1;
+        int c0, r0, c1, r1;
+        if (!(fields >> x0 >> y0 >> x1 >> y1))
+        {
+            error = path + ":" + std::to_string(number) + ": expected x0 y0 x1 y1";
+            return false;
+        }
+        toCell(x0, y0, c0, r0);
+        toCell(x1, y1, c1, r1);
+        if (!links.add(c0, r0, c1, r1))
+        {
+            error = path + ":" + std::to_string(number) + ": link outside the DEM, within a cell or "
+                    "sharing a cell with another link";
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,55 @@
+/***************************************************************
+#                     spillDEM flow links                      #
+****************************************************************
+#                                                              #
+#     Culverts, bridges and other drains under embankments,    #
+#   given as pairs of cells the flood treats as neighbours in  #
+#   addition to the D8 neighbourhood.                          #
+#                                                              #
+***************************************************************/
+
+#ifndef SPILLDEM_LINKS_H
+#define SPILLDEM_LINKS_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Flow direction code of a cell draining through its link
+const unsigned char linkFlow = 5;
+
+// Links between cells of a xSize x ySize raster, followed both ways. A cell
+// has at most one link, so that linkFlow designates a single cell.
+class FlowLinks
+{
+public:
+    FlowLinks(int xSize = 0, int ySize = 0);
+
+    // Link cell (x0, y0) to (x1, y1). Fails when a cell is outside the
+    // raster or already linked, or when both are the same cell.
+    bool add(int x0, int y0, int x1, int y1);
+
+    bool empty() const { return partners.empty(); }
+    size_t size() const { return partners.size() / 2; }
+
+    // Cheap test for the hot loops, partner() is only valid when true
+    bool linked(size_t c) const { return !marks.empty() && marks[c]; }
+    size_t partner(size_t c) const { return partners.at(c); }
+
+    // Distance between the centres of cell c and its partner
+    double length(size_t c, double pixelSizeX, double pixelSizeY) const;
+
+private:
+    int xSize, ySize;
+    std::vector<bool> marks;
+    std::unordered_map<size_t, size_t> partners;
+};
+
+// Read links from a text file of one link per line: the map coordinates of
+// both ends, "x0 y0 x1 y1", separated by blanks or commas. Empty lines and
+// lines starting with '#' are skipped. Coordinates are converted to cells
+// with the (north up) geotransform of the DEM. On failure, error tells the
+// offending line.
+bool readFlowLinks(const std::string& path, const double* geoTransform, FlowLinks& links, std::string& error);
+
+#endif
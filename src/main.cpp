@@ -19,13 +19,65 @@
 
 #include <getopt.h>
 #include <iostream>
-#include <queue>
 #include <climits>
 #include <cmath>
+#include <cstring>
+#include <mutex>
+#include <vector>
 #include "gdal_priv.h"
 #include "cpl_conv.h"
+#include "gdal_utils.h"
 
 #include "SpillDEM.h" // config file
+#include "accum.h"
+#include "blocks.h"
+#include "cluster.h"
+#include "costdist.h"
+#include "ensemble.h"
+#include "fill.h"
+#include "gdalio.h"
+#include "inundation.h"
+#include "links.h"
+#include "parallel.h"
+#include "sysinfo.h"
+#include "terrain.h"
+#include "tiles.h"
+#include "trace.h"
+
+// Name of the part written by worker index in place of path:
+// filled.tif gives filled.3.tif
+static std::string partPath(const std::string& path, int index)
+{
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        dot = path.size();
+    return path.substr(0, dot) + "." + std::to_string(index) + path.substr(dot);
+}
+
+// Virtual mosaic of the parts written by the workers
+static bool buildMosaic(const std::string& path, const std::vector<std::string>& parts)
+{
+    std::vector<const char*> names;
+    for (const std::string& part : parts)
+        names.push_back(part.c_str());
+    GDALDatasetH mosaic = GDALBuildVRT(path.c_str(), (int)names.size(), nullptr, names.data(), nullptr, nullptr);
+    if (mosaic == nullptr)
+    {
+        fprintf(stderr, "Error: Cannot build the mosaic %s\n", path.c_str());
+        return false;
+    }
+    GDALClose(mosaic);
+    return true;
+}
+
+static void printStats(const FillStats& stats)
+{
+    for (const auto& phase : stats.phases)
+        printf("%-8s %.3f s\n", phase.first.c_str(), phase.second);
+    if (stats.pushes)
+        printf("%zu queue pushes, %zu pops\n", stats.pushes, stats.pops);
+}
 
 static void usage(const char* name)
 {
@@ -34,46 +86,94 @@ static void usage(const char* name)
            "Options:\n"
             "\t-o, --output        filled DEM output file\n"
             "\t-f, --flow          D8 flow direction output file\n"
-            "\t-m, --minslope      minimum preserved slope gradient"
+            "\t-i, --in-place      write the filled DEM back to the datasource instead of --output,\n"
+            "\t                    rewriting only the blocks holding raised cells\n"
+            "\t-L, --lerc          store the filled DEM with LERC compression, within this vertical\n"
+            "\t                    tolerance (MAX_Z_ERROR)\n"
+            "\t-Q, --quantize      store the filled DEM as Int16 or Int32 with scale and offset,\n"
+            "\t                    within this vertical tolerance\n"
+            "\t-a, --accum         D8 flow accumulation output file (cell counts)\n"
+            "\t-l, --links         culverts and bridges: text file of links \"x0 y0 x1 y1\" in map\n"
+            "\t                    coordinates, followed by the pq engine as extra neighbours; cells\n"
+            "\t                    draining through their link get flow direction 5\n"
+            "\t-m, --minslope      minimum preserved slope gradient\n"
+            "\t-W, --wrap-x        global DEM: the east and west edges are neighbours across the\n"
+            "\t                    antimeridian instead of outlets (pq and zhou engines)\n"
+            "\t-q, --queue         priority queue: binary (default) or quaternary\n"
+            "\t-T, --trace         record the queue operations to a binary trace file\n"
+            "\t-t, --threads       number of worker threads (default: CPUs available to the process)\n"
+            "\t-e, --engine        filling engine: auto (default), pq, zhou, tiled, bucket\n"
+            "\t                    or basins\n"
+            "\t-M, --memory        memory budget in MB used by --engine auto (default: 80%% of the\n"
+            "\t                    memory available to the process)\n"
+            "\t-z, --tile-size     tile side of the tiled engine (default 1024)\n"
+            "\t-g, --tile-graph    without --tile: compute the tile spill graph of the DEM and save it\n"
+            "\t                    with --tile: the saved graph to fill the tile from\n"
+            "\t-k, --tile          fill only the tile at column,row of the tile grid (e.g. 3,7)\n"
+            "\t-S, --slope         slope output file, in degrees\n"
+            "\t-A, --aspect        aspect output file, in degrees clockwise from north\n"
+            "\t-P, --plan-curvature     plan curvature output file\n"
+            "\t-X, --profile-curvature  profile curvature output file\n"
+            "\t-c, --coordinator   distributed tiled filling: coordinate workers on this TCP port,\n"
+            "\t                    [address:]port listening on 127.0.0.1 unless an address is\n"
+            "\t                    given, and write --output and --flow as VRT mosaics of their parts\n"
+            "\t-n, --workers       number of workers the coordinator waits for (default 1)\n"
+            "\t-w, --worker        distributed tiled filling: work for the coordinator at host:port,\n"
+            "\t                    writing the strip filled as --output and --flow with the worker\n"
+            "\t                    number inserted before the extension\n"
+            "\t-E, --ensemble      Monte Carlo mode: number of perturbed fills, writes --probability\n"
+            "\t                    and --depth instead of the filled DEM and flow directions\n"
+            "\t-R, --rmse          vertical error RMSE of the ensemble, in DEM units (default 1)\n"
+            "\t-s, --seed          random seed of the ensemble (default 0)\n"
+            "\t-p, --probability   ensemble depression probability output file\n"
+            "\t-d, --depth         ensemble expected depression depth output file\n"
+            "\t-D, --cost-distance cost distance mode: the datasource is a cost raster and this raster\n"
+            "\t                    marks the sources (non zero cells), writes the accumulated cost as\n"
+            "\t                    --output and the back-link directions as --flow\n"
+            "\t-I, --inundation    inundation threshold mode: write as --output the water level at which\n"
+            "\t                    every cell is connected to the ocean, given as the non zero cells of\n"
+            "\t                    this raster, or 'edge' for the raster edge and nodata as in filling\n"
             "\t-v, --verbose       display information messages\n"
             "\n"
             "\t-h, --help          display this message and exit\n",
             name, SpillDEM_VERSION_MAJOR, SpillDEM_VERSION_MINOR, name);
 }
 
-struct node
-{
-    float spill;
-    int x;
-    int y;
-
-    node(float spill, int x, int y) 
-        : spill(spill), x(x), y(y)
-    {}
-
-    bool operator<(const node& rhs) const
-    {
-        return spill > rhs.spill;
-    }
-};
-
-struct dir
-{
-    int dx;
-    int dy;
-
-    dir(int dx, int dy)
-        : dx(dx), dy(dy)
-    {}
-};
-
 int main(int argc, char* argv[])
 {
     const option long_opts[] =
     {
         {"output", required_argument, nullptr, 'o'},
         {"flow", required_argument, nullptr, 'f'},
+        {"in-place", no_argument, nullptr, 'i'},
+        {"wrap-x", no_argument, nullptr, 'W'},
+        {"lerc", required_argument, nullptr, 'L'},
+        {"quantize", required_argument, nullptr, 'Q'},
+        {"accum", required_argument, nullptr, 'a'},
+        {"links", required_argument, nullptr, 'l'},
         {"minslope", required_argument, nullptr, 'm'},
+        {"queue", required_argument, nullptr, 'q'},
+        {"trace", required_argument, nullptr, 'T'},
+        {"threads", required_argument, nullptr, 't'},
+        {"engine", required_argument, nullptr, 'e'},
+        {"memory", required_argument, nullptr, 'M'},
+        {"tile-size", required_argument, nullptr, 'z'},
+        {"tile-graph", required_argument, nullptr, 'g'},
+        {"tile", required_argument, nullptr, 'k'},
+        {"slope", required_argument, nullptr, 'S'},
+        {"aspect", required_argument, nullptr, 'A'},
+        {"plan-curvature", required_argument, nullptr, 'P'},
+        {"profile-curvature", required_argument, nullptr, 'X'},
+        {"coordinator", required_argument, nullptr, 'c'},
+        {"workers", required_argument, nullptr, 'n'},
+        {"worker", required_argument, nullptr, 'w'},
+        {"ensemble", required_argument, nullptr, 'E'},
+        {"rmse", required_argument, nullptr, 'R'},
+        {"seed", required_argument, nullptr, 's'},
+        {"probability", required_argument, nullptr, 'p'},
+        {"depth", required_argument, nullptr, 'd'},
+        {"cost-distance", required_argument, nullptr, 'D'},
+        {"inundation", required_argument, nullptr, 'I'},
         {"verbose", no_argument, nullptr, 'v'},
         {"help", no_argument, nullptr, 'h'},
         {0, 0, 0, 0}
@@ -81,11 +181,37 @@ int main(int argc, char* argv[])
 
     int opt;
     bool verbose = false;
+    bool inPlace = false;
+    bool wrapX = false;
     float minslope = 0.1;
     std::string infile = "";
     std::string spill_outfile = "filled.tif";
     std::string flow_outfile = "flow.tif";
-    while ((opt = getopt_long(argc, argv, ":o:f:m:vh", long_opts, nullptr)) != -1) 
+    std::string accum_outfile = "";
+    std::string links_file = "";
+    ElevationStorage storage;
+    std::string trace_outfile = "";
+    std::string graph_file = "";
+    std::string slope_outfile = "";
+    std::string aspect_outfile = "";
+    std::string plan_outfile = "";
+    std::string profile_outfile = "";
+    std::string probability_outfile = "probability.tif";
+    std::string depth_outfile = "depth.tif";
+    std::string sources_file = "";
+    std::string ocean_file = "";
+    std::string coordinator_host = "";
+    std::string coordinator_bind = "127.0.0.1"; // no authentication, local unless asked
+    int coordinator_port = 0, workers = 1;
+    bool coordinator = false;
+    EnsembleParams ensemble;
+    ensemble.runs = 0; // no ensemble
+    int threads = availableCpus();
+    int tileSize = 1024, tileX = -1, tileY = -1;
+    uint64_t memoryBudget = 0;
+    const engine* fillEngine = nullptr; // selected from the memory budget
+    QueueKind queueKind = QueueKind::Binary;
+    while ((opt = getopt_long(argc, argv, ":o:f:iWL:Q:a:l:m:q:T:t:e:M:z:g:k:S:A:P:X:c:n:w:E:R:s:p:d:D:I:vh", long_opts, nullptr)) != -1) 
     {
         switch (opt) 
         {
@@ -98,9 +224,154 @@ int main(int argc, char* argv[])
         case 'f':
             flow_outfile = std::string(optarg);
             break;
+        case 'i':
+            inPlace = true;
+            break;
+        case 'W':
+            wrapX = true;
+            break;
+        case 'L':
+        case 'Q':
+            storage.encoding = opt == 'L' ? ElevationStorage::Lerc : ElevationStorage::Quantized;
+            storage.tolerance = std::atof(optarg);
+            if (storage.tolerance <= 0.0)
+            {
+                fprintf(stderr, "Error: Invalid vertical tolerance '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'a':
+            accum_outfile = std::string(optarg);
+            break;
+        case 'l':
+            links_file = std::string(optarg);
+            break;
         case 'm':
             minslope = std::atof(optarg);
             break;
+        case 'q':
+            if (!parseQueueKind(optarg, queueKind))
+            {
+                fprintf(stderr, "Error: Unknown queue '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'T':
+            trace_outfile = std::string(optarg);
+            break;
+        case 't':
+            threads = std::max(1, std::atoi(optarg));
+            break;
+        case 'e':
+            fillEngine = findEngine(optarg);
+            if (fillEngine == nullptr && strcmp(optarg, "auto") != 0)
+            {
+                fprintf(stderr, "Error: Unknown engine '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'M':
+            memoryBudget = (uint64_t)(std::atof(optarg) * 1024 * 1024);
+            break;
+        case 'z':
+            tileSize = std::atoi(optarg);
+            if (tileSize < 3)
+            {
+                fprintf(stderr, "Error: Invalid tile size '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'g':
+            graph_file = std::string(optarg);
+            break;
+        case 'k':
+            if (sscanf(optarg, "%d,%d", &tileX, &tileY) != 2 || tileX < 0 || tileY < 0)
+            {
+                fprintf(stderr, "Error: Invalid tile '%s', expected column,row\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'S':
+            slope_outfile = std::string(optarg);
+            break;
+        case 'A':
+            aspect_outfile = std::string(optarg);
+            break;
+        case 'P':
+            plan_outfile = std::string(optarg);
+            break;
+        case 'X':
+            profile_outfile = std::string(optarg);
+            break;
+        case 'c':
+        {
+            coordinator = true;
+            std::string address(optarg);
+            size_t colon = address.find_last_of(':');
+            if (colon != std::string::npos)
+            {
+                coordinator_bind = address.substr(0, colon);
+                if (coordinator_bind.size() > 2 && coordinator_bind.front() == '[' && coordinator_bind.back() == ']')
+                    coordinator_bind = coordinator_bind.substr(1, coordinator_bind.size() - 2);
+            }
+            coordinator_port = std::atoi(address.c_str() + (colon == std::string::npos ? 0 : colon + 1));
+            if (coordinator_bind.empty() || coordinator_port <= 0 || coordinator_port > 65535)
+            {
+                fprintf(stderr, "Error: Invalid coordinator address '%s', expected [address:]port\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case 'n':
+            workers = std::atoi(optarg);
+            if (workers < 1)
+            {
+                fprintf(stderr, "Error: Invalid number of workers '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'w':
+        {
+            std::string address(optarg);
+            size_t colon = address.find_last_of(':');
+            if (colon != std::string::npos)
+            {
+                coordinator_host = address.substr(0, colon);
+                coordinator_port = std::atoi(address.c_str() + colon + 1);
+            }
+            if (coordinator_host.empty() || coordinator_port <= 0 || coordinator_port > 65535)
+            {
+                fprintf(stderr, "Error: Invalid coordinator address '%s', expected host:port\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case 'E':
+            ensemble.runs = std::atoi(optarg);
+            if (ensemble.runs < 1)
+            {
+                fprintf(stderr, "Error: Invalid ensemble size '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'R':
+            ensemble.rmse = std::atof(optarg);
+            break;
+        case 's':
+            ensemble.seed = (uint32_t)std::strtoul(optarg, nullptr, 10);
+            break;
+        case 'p':
+            probability_outfile = std::string(optarg);
+            break;
+        case 'd':
+            depth_outfile = std::string(optarg);
+            break;
+        case 'D':
+            sources_file = std::string(optarg);
+            break;
+        case 'I':
+            ocean_file = std::string(optarg);
+            break;
         case 'h':
             usage(argv[0]);
             exit(EXIT_SUCCESS);
@@ -136,7 +407,7 @@ int main(int argc, char* argv[])
     }
 
     GDALDataset *srcDataset;
-    srcDataset = (GDALDataset *)GDALOpen(infile.c_str(), GA_ReadOnly);
+    srcDataset = (GDALDataset *)GDALOpen(infile.c_str(), inPlace ? GA_Update : GA_ReadOnly);
     if ( srcDataset == nullptr)
     {
         exit(EXIT_FAILURE);
@@ -146,205 +417,616 @@ int main(int argc, char* argv[])
     srcBand = srcDataset->GetRasterBand(1);
     const int xSize = srcBand->GetXSize(), ySize = srcBand->GetYSize();
     double nodata = srcBand->GetNoDataValue();
+    double adfGeoTransform[6];
+    srcDataset->GetGeoTransform(adfGeoTransform);
 
-    GDALDataset *flowDataset, *spillDataset;
-    flowDataset = driver->Create(flow_outfile.c_str(), xSize, ySize, 1, GDT_Byte, NULL);
-    spillDataset = driver->Create(spill_outfile.c_str(), xSize, ySize, 1, GDT_Float32, NULL);
-    if ( flowDataset == nullptr )
+    // Size the defaults after what the process may use, which in a container
+    // is the cgroup limit rather than the host memory
+    const uint64_t available = availableMemory();
+    if (memoryBudget == 0)
+        memoryBudget = available / 10 * 8;
+    if (CPLGetConfigOption("GDAL_CACHEMAX", nullptr) == nullptr)
+        GDALSetCacheMax64(available / 20);
+
+    // Footprint of the in-memory engines: elevation, flow direction, queue
+    // state bits and a margin for the queue itself, plus the accumulation
+    // and the terrain derivatives
+    const int derivatives = !slope_outfile.empty() + !aspect_outfile.empty() + !plan_outfile.empty()
+                          + !profile_outfile.empty();
+    const bool wholeRaster = !(accum_outfile.empty() && trace_outfile.empty()) || derivatives > 0;
+    const double bytesPerCell = 6.5 + (accum_outfile.empty() ? 0.0 : 9.0) + 4.0 * derivatives;
+    const double inMemory = bytesPerCell * xSize * ySize;
+    const bool engineGiven = fillEngine != nullptr; // rather than auto
+    if (fillEngine == nullptr && (coordinator || !coordinator_host.empty()))
     {
-        GDALClose(srcDataset);
-        exit(EXIT_FAILURE);
+        fillEngine = findEngine("tiled");
     }
-    if ( spillDataset == nullptr )
+    else if (fillEngine == nullptr)
     {
+        if (inMemory <= memoryBudget || wholeRaster || ensemble.runs || !sources_file.empty() || !ocean_file.empty() || !links_file.empty() || wrapX)
+        {
+            fillEngine = findEngine("pq");
+        }
+        else if (minslope > 0.0)
+        {
+            fprintf(stderr, "Warning: about %.0f MB needed for a %.0f MB budget, the tiled engine "
+                    "would fit but only supports --minslope 0\n", inMemory / 1048576, memoryBudget / 1048576.0);
+            fillEngine = findEngine("pq");
+        }
+        else
+        {
+            fillEngine = findEngine("tiled");
+        }
+    }
+    if (verbose)
+        printf("%d threads, %.0f MB memory budget, %s engine\n", threads, memoryBudget / 1048576.0, fillEngine->name);
+
+    const bool distributed = coordinator || !coordinator_host.empty();
+    const bool tiled = fillEngine->fill == fillTiledInMemory || !graph_file.empty() || tileX >= 0 || distributed;
+    const char* error = nullptr;
+    if (tiled && minslope > 0.0)
+        error = "Tiled filling only supports flat filling, use --minslope 0";
+    else if (!fillEngine->gradient && minslope > 0.0)
+        error = "This engine only supports flat filling, use --minslope 0";
+    else if (tiled && wholeRaster)
+        error = "--accum, --trace and the terrain derivatives need the whole raster in memory, use the pq engine";
+    else if (ensemble.runs && (tiled || wholeRaster))
+        error = "--ensemble runs in memory and only writes --probability and --depth";
+    else if (!sources_file.empty() && (engineGiven || tiled || wholeRaster || ensemble.runs))
+        error = "--cost-distance runs its own in-memory search, selected with --queue rather than --engine, and only writes --output and --flow";
+    else if (!ocean_file.empty() && (engineGiven || tiled || wholeRaster || ensemble.runs || !sources_file.empty()))
+        error = "--inundation runs its own in-memory flood, selected with --queue rather than --engine, and only writes --output";
+    else if (!links_file.empty() && (fillEngine->fill != fillPriorityFlood || !sources_file.empty() || !ocean_file.empty()))
+        error = "--links are only followed by the pq engine";
+    else if (wrapX && ((fillEngine->fill != fillPriorityFlood && fillEngine->fill != fillRegionGrowing)
+                       || tiled || ensemble.runs || !sources_file.empty() || !ocean_file.empty()))
+        error = "--wrap-x applies to in-memory filling with the pq or zhou engine";
+    else if (inPlace && (tiled || ensemble.runs || !sources_file.empty() || !ocean_file.empty()))
+        error = "--in-place only applies to in-memory filling";
+    else if (inPlace && storage.encoding != ElevationStorage::Float)
+        error = "--in-place keeps the type of the datasource, --lerc and --quantize do not apply";
+    else if (inPlace && srcBand->GetRasterDataType() != GDT_Float32
+             && !(GDALDataTypeIsInteger(srcBand->GetRasterDataType())
+                  && GDALGetDataTypeSizeBytes(srcBand->GetRasterDataType()) <= 2))
+        error = "--in-place rewrites whole blocks from Float32, which only holds Float32 and 8 or 16 bit integer DEMs exactly";
+    else if (inPlace && minslope > 0.0 && srcBand->GetRasterDataType() != GDT_Float32)
+        error = "--in-place on an integer DEM rounds the raised cells, use --minslope 0";
+    else if ((!sources_file.empty() || !ocean_file.empty()) && storage.encoding != ElevationStorage::Float)
+        error = "--lerc and --quantize only apply to the filled DEM";
+    else if (coordinator && !coordinator_host.empty())
+        error = "--coordinator and --worker are exclusive";
+    else if (distributed && !(graph_file.empty() && tileX < 0))
+        error = "--coordinator and --worker do not use a saved tile graph";
+    else if (tileX >= 0 && graph_file.empty())
+        error = "--tile needs the tile graph of the DEM (--tile-graph)";
+    if (error)
+    {
+        fprintf(stderr, "Error: %s\n", error);
         GDALClose(srcDataset);
-        GDALClose(flowDataset);
         exit(EXIT_FAILURE);
     }
-    double adfGeoTransform[6];
-    srcDataset->GetGeoTransform(adfGeoTransform);
-    flowDataset->SetGeoTransform(adfGeoTransform);
-    flowDataset->SetSpatialRef(srcDataset->GetSpatialRef());
-    spillDataset->SetGeoTransform(adfGeoTransform);
-    spillDataset->SetSpatialRef(srcDataset->GetSpatialRef());
-    
-    flowBand = flowDataset->GetRasterBand(1);
-    flowBand->SetNoDataValue(255);
-    spillBand = spillDataset->GetRasterBand(1);
-    spillBand->SetNoDataValue(nodata);
 
-    float *elev;
-    elev = (float *) CPLMalloc(sizeof(float)*xSize*ySize);
-    srcBand->RasterIO(GF_Read, 0, 0, xSize, ySize, elev, xSize, ySize, GDT_Float32, 0, 0);
-
-    bool preserve;
-    std::array<dir, 8> ngh = { dir(1, 0), dir(1, -1), dir(0, -1),
-                               dir(-1, -1), dir(-1, 0), dir(-1, 1),
-                               dir(0, 1), dir(1, 1) };
-    float pixelSizeX = adfGeoTransform[1], pixelSizeY = adfGeoTransform[5];
-    float diaglength = std::sqrt(pixelSizeX * pixelSizeX + pixelSizeY * pixelSizeY);
-    std::array<float, 8> length = { pixelSizeX, diaglength, pixelSizeY,
-                                    diaglength, pixelSizeX, diaglength,
-                                    pixelSizeY, diaglength};
-    std::array<float, 8> mindiff;
-
-    if( minslope > 0.0 )
-	{
-		minslope = std::tan(minslope * M_PI / 180.0);
-		for(int d=0; d<8; d++)
-			mindiff[d] = minslope * length[d];
-		preserve = true;
-	}
-	else
+
+    // Flat filling never leaves the range of the source, so tiled outputs
+    // can be quantized before the DEM is filled
+    if (storage.encoding == ElevationStorage::Quantized && tiled)
     {
-		preserve = false;
+        double range[2];
+        if (srcBand->ComputeRasterMinMax(FALSE, range) != CE_None || !storage.fitRange(range[0], range[1]))
+        {
+            fprintf(stderr, "Error: Cannot quantize %s at a %g tolerance\n", infile.c_str(), storage.tolerance);
+            GDALClose(srcDataset);
+            exit(EXIT_FAILURE);
+        }
     }
 
-    auto getNeighbourX = [&](int x, int d){ return x + ngh[d].dx; };
-    auto getNeighbourY = [&](int y, int d){ return y + ngh[d].dy; };
-    auto getIndex = [&](int x, int y){ return y * xSize + x; };
-    auto isInBounds = [&](int x, int y){ return x >= 0 && x < xSize && y >= 0 && y < ySize; };
+    FillParams params;
+    params.minslope = minslope;
+    params.nodata = nodata;
+    params.pixelSizeX = adfGeoTransform[1];
+    params.pixelSizeY = adfGeoTransform[5];
+    params.queue = queueKind;
+    params.threads = threads;
+    params.tileSize = tileSize;
+    params.wrapX = wrapX;
 
-    std::array<unsigned char, 9> d8 = {1, 2, 4, 8, 16, 32, 64, 128, 0};
-    std::array<unsigned char, 9> ldd = {6, 3, 2, 1, 4, 7, 8, 9, 0};
-    std::priority_queue<node> queue;
-    std::vector<bool> queued(xSize*ySize, false);
-    std::vector<bool> processed(xSize*ySize, false);
-    std::vector<char> flowdir(xSize*ySize, 0);
+    FlowLinks links(xSize, ySize);
+    if (!links_file.empty())
+    {
+        std::string message;
+        if (!readFlowLinks(links_file, adfGeoTransform, links, message))
+        {
+            fprintf(stderr, "Error: %s\n", message.c_str());
+            GDALClose(srcDataset);
+            exit(EXIT_FAILURE);
+        }
+        if (verbose)
+            printf("%zu links\n", links.size());
+        params.links = &links;
+    }
+
+    FillStats stats;
+    std::mutex ioLock;
+    WindowReader read = [&](int x0, int y0, int w, int h, float* buffer)
+    {
+        std::lock_guard<std::mutex> lock(ioLock);
+        return rasterWindow(srcBand, GF_Read, x0, y0, w, h, buffer, GDT_Float32);
+    };
 
-    auto getFlowDir = [&](int x, int y, int z)
+    if (coordinator)
     {
-        float maxgrad = -1.0, grad;
-        char dmax = 8;
-        int nx, ny, n;
-        for (int d = 0; d < 8; d++)
-        {
-            nx = getNeighbourX(x, d);
-            ny = getNeighbourY(y, d);
-            n = getIndex(nx ,ny);
-            if ( isInBounds(nx, ny) && processed[n] && elev[n] <= z)
+        // Distributed filling: the workers read the DEM themselves, the
+        // coordinator only solves the spill graph and joins their parts
+        std::vector<WorkerPart> parts;
+        if (verbose)
+            printf("Waiting for %d workers on %s port %d\n", workers, coordinator_bind.c_str(), coordinator_port);
+        bool ok = runCoordinator(coordinator_bind, coordinator_port, workers, TileLayout(xSize, ySize, tileSize), nodata, parts, &stats);
+        GDALClose(srcDataset);
+        if (ok)
+        {
+            std::vector<std::string> filledParts, flowParts;
+            for (const WorkerPart& part : parts)
             {
-                grad = (z - elev[n]) / length[d];
-                if (grad > maxgrad)
-                {
-                    maxgrad = grad;
-                    dmax = d;
-                }
+                if (part.h == 0)
+                    continue;
+                filledParts.push_back(part.filled);
+                flowParts.push_back(part.flow);
+                if (verbose)
+                    printf("rows %d-%d: %s, %s\n", part.y0, part.y0 + part.h - 1, part.filled.c_str(), part.flow.c_str());
             }
+            ok = buildMosaic(spill_outfile, filledParts) && buildMosaic(flow_outfile, flowParts);
         }
-        return dmax;
-    };
-
-    int c, n, nx, ny;
-    float z, nz;
+        if (verbose)
+            printStats(stats);
+        exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
 
-    // Initialize edge cells
-    for (int x = 0; x < xSize; x++)
+    if (!coordinator_host.empty())
     {
-        for (int y = 0; y < ySize; y++)
+        ClusterWorker worker;
+        if (!worker.connect(coordinator_host, coordinator_port, xSize, ySize))
         {
-            int n = getIndex(x, y);
-            z = elev[n];
-            if (elev[n] == nodata)
+            fprintf(stderr, "Error: Failed joining the coordinator at %s:%d\n", coordinator_host.c_str(), coordinator_port);
+            GDALClose(srcDataset);
+            exit(EXIT_FAILURE);
+        }
+        int y0, h;
+        worker.strip(y0, h);
+        params.nodata = worker.nodata();
+        bool ok = worker.summarize(read, threads, &stats);
+        std::string filledPart, flowPart;
+        if (ok && h > 0)
+        {
+            // The strip of the worker, written as a georeferenced part
+            double stripGeoTransform[6];
+            std::copy(adfGeoTransform, adfGeoTransform + 6, stripGeoTransform);
+            stripGeoTransform[0] += y0 * adfGeoTransform[2];
+            stripGeoTransform[3] += y0 * adfGeoTransform[5];
+            filledPart = partPath(spill_outfile, worker.index());
+            flowPart = partPath(flow_outfile, worker.index());
+            GDALDataset *flowDataset = createOutput(driver, flowPart, xSize, h, GDT_Byte, srcDataset, stripGeoTransform, 255);
+            GDALDataset *spillDataset = createElevationOutput(driver, filledPart, xSize, h, srcDataset, stripGeoTransform, worker.nodata(), storage);
+            ok = flowDataset != nullptr && spillDataset != nullptr;
+            if (ok)
             {
-                processed[n] = true;
-                flowdir[n] = 255;
+                GDALRasterBand *flowPartBand = flowDataset->GetRasterBand(1), *spillPartBand = spillDataset->GetRasterBand(1);
+                int flowBlockX, flowBlockY, spillBlockX, spillBlockY;
+                flowPartBand->GetBlockSize(&flowBlockX, &flowBlockY);
+                spillPartBand->GetBlockSize(&spillBlockX, &spillBlockY);
+                BlockWriter flowBlocks(xSize, h, flowBlockX, flowBlockY, 1, [&](int x0, int by0, int w, int bh, const void* data)
+                {
+                    return rasterWindow(flowPartBand, GF_Write, x0, by0, w, bh, (void*)data, GDT_Byte);
+                });
+                BlockWriter spillBlocks(xSize, h, spillBlockX, spillBlockY, sizeof(float), [&](int x0, int by0, int w, int bh, const void* data)
+                {
+                    return writeElevation(spillPartBand, x0, by0, w, bh, (const float*)data, worker.nodata(), storage);
+                });
+                TileSink write = [&](int x0, int ty0, int w, int th, const float* tileElev, const unsigned char* tileFlow)
+                {
+                    flowBlocks.write(x0, ty0 - y0, w, th, tileFlow);
+                    spillBlocks.write(x0, ty0 - y0, w, th, tileElev);
+                };
+                ok = worker.fill(read, params, write, &stats);
+                ok = flowBlocks.finish() && ok;
+                ok = spillBlocks.finish() && ok;
             }
-            else
+            if ( flowDataset != nullptr )
+                GDALClose(flowDataset);
+            if ( spillDataset != nullptr )
+                GDALClose(spillDataset);
+
+            // The coordinator may run in another directory
+            char resolved[PATH_MAX];
+            if (ok && realpath(filledPart.c_str(), resolved))
+                filledPart = resolved;
+            if (ok && realpath(flowPart.c_str(), resolved))
+                flowPart = resolved;
+        }
+        else if (ok)
+        {
+            ok = worker.fill(read, params, TileSink(), &stats);
+        }
+        ok = worker.finish(ok, filledPart, flowPart) && ok;
+        if (verbose)
+            printStats(stats);
+        GDALClose(srcDataset);
+        if (!ok)
+        {
+            fprintf(stderr, "Error: Worker %d failed\n", worker.index());
+            exit(EXIT_FAILURE);
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    if (!graph_file.empty() && tileX < 0)
+    {
+        // Preprocessing only: solve the tile graph and save it
+        TileGraph graph;
+        bool ok = graph.build(TileLayout(xSize, ySize, tileSize), read, nodata, threads, &stats);
+        if (!ok || !graph.save(graph_file))
+        {
+            fprintf(stderr, "Error: Failed computing the tile graph to %s\n", graph_file.c_str());
+            GDALClose(srcDataset);
+            exit(EXIT_FAILURE);
+        }
+        if (verbose)
+        {
+            printStats(stats);
+            printf("%d x %d tiles of %d cells\n", graph.layout().xTiles, graph.layout().yTiles, tileSize);
+        }
+        GDALClose(srcDataset);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (tileX >= 0)
+    {
+        // Fill a single tile from the saved graph
+        TileGraph graph;
+        if (!graph.open(graph_file) || graph.layout().xSize != xSize || graph.layout().ySize != ySize)
+        {
+            fprintf(stderr, "Error: %s is not a tile graph of %s\n", graph_file.c_str(), infile.c_str());
+            GDALClose(srcDataset);
+            exit(EXIT_FAILURE);
+        }
+        const TileLayout& layout = graph.layout();
+        if (tileX >= layout.xTiles || tileY >= layout.yTiles)
+        {
+            fprintf(stderr, "Error: Tile %d,%d is outside the %d x %d tile grid\n", tileX, tileY, layout.xTiles, layout.yTiles);
+            GDALClose(srcDataset);
+            exit(EXIT_FAILURE);
+        }
+        int t = tileY * layout.xTiles + tileX, x0, y0, w, h;
+        layout.window(t, x0, y0, w, h);
+        std::vector<float> tileElev(w*h);
+        std::vector<unsigned char> tileFlow(w*h);
+        if (!graph.fillTile(t, read, params, tileElev.data(), tileFlow.data()))
+        {
+            fprintf(stderr, "Error: Failed filling tile %d,%d\n", tileX, tileY);
+            GDALClose(srcDataset);
+            exit(EXIT_FAILURE);
+        }
+        double tileGeoTransform[6];
+        std::copy(adfGeoTransform, adfGeoTransform + 6, tileGeoTransform);
+        tileGeoTransform[0] += x0 * adfGeoTransform[1] + y0 * adfGeoTransform[2];
+        tileGeoTransform[3] += x0 * adfGeoTransform[4] + y0 * adfGeoTransform[5];
+        GDALDataset *flowDataset = createOutput(driver, flow_outfile, w, h, GDT_Byte, srcDataset, tileGeoTransform, 255);
+        GDALDataset *spillDataset = createElevationOutput(driver, spill_outfile, w, h, srcDataset, tileGeoTransform, nodata, storage);
+        if ( flowDataset == nullptr || spillDataset == nullptr )
+        {
+            if ( flowDataset != nullptr )
+                GDALClose(flowDataset);
+            if ( spillDataset != nullptr )
+                GDALClose(spillDataset);
+            GDALClose(srcDataset);
+            exit(EXIT_FAILURE);
+        }
+        rasterWindow(flowDataset->GetRasterBand(1), GF_Write, 0, 0, w, h, tileFlow.data(), GDT_Byte);
+        writeElevation(spillDataset->GetRasterBand(1), 0, 0, w, h, tileElev.data(), nodata, storage);
+        GDALClose(flowDataset);
+        GDALClose(spillDataset);
+        GDALClose(srcDataset);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (ensemble.runs)
+    {
+        // Monte Carlo mode: the source grid is read once and shared, the
+        // perturbed copies live in the worker threads
+        GDALDataset *probabilityDataset = createOutput(driver, probability_outfile, xSize, ySize, GDT_Float32, srcDataset, adfGeoTransform, nodata);
+        GDALDataset *depthDataset = createOutput(driver, depth_outfile, xSize, ySize, GDT_Float32, srcDataset, adfGeoTransform, nodata);
+        if ( probabilityDataset == nullptr || depthDataset == nullptr )
+        {
+            if ( probabilityDataset != nullptr )
+                GDALClose(probabilityDataset);
+            if ( depthDataset != nullptr )
+                GDALClose(depthDataset);
+            GDALClose(srcDataset);
+            exit(EXIT_FAILURE);
+        }
+        std::vector<float> elev(xSize*ySize), probability(xSize*ySize), depth(xSize*ySize);
+        readRaster(srcBand, elev.data());
+        if (verbose)
+            printf("%d runs, vertical RMSE %g\n", ensemble.runs, ensemble.rmse);
+        fillEnsemble(elev.data(), xSize, ySize, params, fillEngine->fill, ensemble, probability.data(), depth.data(), &stats);
+        if (verbose)
+            printStats(stats);
+        writeRaster(probabilityDataset->GetRasterBand(1), probability.data(), GDT_Float32);
+        writeRaster(depthDataset->GetRasterBand(1), depth.data(), GDT_Float32);
+        GDALClose(probabilityDataset);
+        GDALClose(depthDataset);
+        GDALClose(srcDataset);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (!sources_file.empty())
+    {
+        // Cost distance mode: the same queue flood, seeded from the sources
+        GDALDataset *sourcesDataset = (GDALDataset *)GDALOpen(sources_file.c_str(), GA_ReadOnly);
+        if ( sourcesDataset == nullptr || sourcesDataset->GetRasterXSize() != xSize || sourcesDataset->GetRasterYSize() != ySize )
+        {
+            fprintf(stderr, "Error: %s is not a source raster of the size of %s\n", sources_file.c_str(), infile.c_str());
+            if ( sourcesDataset != nullptr )
+                GDALClose(sourcesDataset);
+            GDALClose(srcDataset);
+            exit(EXIT_FAILURE);
+        }
+        GDALRasterBand *sourcesBand = sourcesDataset->GetRasterBand(1);
+        int hasNodata = FALSE;
+        double sourcesNodata = sourcesBand->GetNoDataValue(&hasNodata);
+        std::vector<float> cost(xSize*ySize), values(xSize*ySize);
+        std::vector<unsigned char> source(xSize*ySize), backlink(xSize*ySize);
+        readRaster(srcBand, cost.data());
+        readRaster(sourcesBand, values.data());
+        GDALClose(sourcesDataset);
+        for (size_t c = 0; c < (size_t)xSize * ySize; c++)
+            source[c] = values[c] != 0.0f && !(hasNodata && values[c] == (float)sourcesNodata);
+
+        // The sources values are no longer needed, reuse them for the costs
+        float* accumulated = values.data();
+        costDistance(cost.data(), source.data(), xSize, ySize, params, accumulated, backlink.data(), &stats);
+        if (verbose)
+            printStats(stats);
+
+        GDALDataset *costDataset = createOutput(driver, spill_outfile, xSize, ySize, GDT_Float32, srcDataset, adfGeoTransform, nodata);
+        GDALDataset *linkDataset = createOutput(driver, flow_outfile, xSize, ySize, GDT_Byte, srcDataset, adfGeoTransform, 255);
+        bool ok = costDataset != nullptr && linkDataset != nullptr;
+        if ( costDataset != nullptr )
+        {
+            ok = writeRaster(costDataset->GetRasterBand(1), accumulated, GDT_Float32) && ok;
+            GDALClose(costDataset);
+        }
+        if ( linkDataset != nullptr )
+        {
+            ok = writeRaster(linkDataset->GetRasterBand(1), backlink.data(), GDT_Byte) && ok;
+            GDALClose(linkDataset);
+        }
+        GDALClose(srcDataset);
+        exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if (!ocean_file.empty())
+    {
+        // Inundation threshold mode: one connected flood from the ocean
+        // answers every water level
+        std::vector<unsigned char> ocean;
+        if (ocean_file != "edge")
+        {
+            GDALDataset *oceanDataset = (GDALDataset *)GDALOpen(ocean_file.c_str(), GA_ReadOnly);
+            if ( oceanDataset == nullptr || oceanDataset->GetRasterXSize() != xSize || oceanDataset->GetRasterYSize() != ySize )
             {
-                for (int d = 0; d < 8; d++)
-                {
-                    nx = getNeighbourX(x, d);
-                    ny = getNeighbourY(y, d);
-                    if ( !isInBounds(nx, ny) || elev[getIndex(nx, ny)] == nodata )
-                    {
-                        flowdir[n] = 255;
-                        queue.push(std::move(node(z, x, y)));
-                        queued[n] = true;
-                        break;
-                    }
-                }
+                fprintf(stderr, "Error: %s is not an ocean raster of the size of %s\n", ocean_file.c_str(), infile.c_str());
+                if ( oceanDataset != nullptr )
+                    GDALClose(oceanDataset);
+                GDALClose(srcDataset);
+                exit(EXIT_FAILURE);
             }
+            GDALRasterBand *oceanBand = oceanDataset->GetRasterBand(1);
+            int hasNodata = FALSE;
+            double oceanNodata = oceanBand->GetNoDataValue(&hasNodata);
+            std::vector<float> values(xSize*ySize);
+            readRaster(oceanBand, values.data());
+            GDALClose(oceanDataset);
+            ocean.resize(xSize*ySize);
+            for (size_t c = 0; c < (size_t)xSize * ySize; c++)
+                ocean[c] = values[c] != 0.0f && !(hasNodata && values[c] == (float)oceanNodata);
+        }
+        std::vector<float> elev(xSize*ySize), threshold(xSize*ySize);
+        readRaster(srcBand, elev.data());
+        inundationThreshold(elev.data(), ocean.empty() ? nullptr : ocean.data(), xSize, ySize, params, threshold.data(), &stats);
+        if (verbose)
+            printStats(stats);
+
+        GDALDataset *thresholdDataset = createOutput(driver, spill_outfile, xSize, ySize, GDT_Float32, srcDataset, adfGeoTransform, nodata);
+        bool ok = thresholdDataset != nullptr;
+        if ( thresholdDataset != nullptr )
+        {
+            ok = writeRaster(thresholdDataset->GetRasterBand(1), threshold.data(), GDT_Float32);
+            GDALClose(thresholdDataset);
+        }
+        GDALClose(srcDataset);
+        exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    GDALDataset *flowDataset, *spillDataset;
+    flowDataset = createOutput(driver, flow_outfile, xSize, ySize, GDT_Byte, srcDataset, adfGeoTransform, 255);
+    if ( flowDataset == nullptr )
+    {
+        GDALClose(srcDataset);
+        exit(EXIT_FAILURE);
+    }
+    flowBand = flowDataset->GetRasterBand(1);
+
+    if (tiled)
+    {
+        spillDataset = createElevationOutput(driver, spill_outfile, xSize, ySize, srcDataset, adfGeoTransform, nodata, storage);
+        if ( spillDataset == nullptr )
+        {
+            GDALClose(srcDataset);
+            GDALClose(flowDataset);
+            exit(EXIT_FAILURE);
         }
+        spillBand = spillDataset->GetRasterBand(1);
+
+        // Tile by tile, the DEM is never held in memory as a whole, and
+        // output blocks are written as soon as their tiles are all done
+        int flowBlockX, flowBlockY, spillBlockX, spillBlockY;
+        flowBand->GetBlockSize(&flowBlockX, &flowBlockY);
+        spillBand->GetBlockSize(&spillBlockX, &spillBlockY);
+        BlockWriter flowBlocks(xSize, ySize, flowBlockX, flowBlockY, 1, [&](int x0, int y0, int w, int h, const void* data)
+        {
+            return rasterWindow(flowBand, GF_Write, x0, y0, w, h, (void*)data, GDT_Byte);
+        });
+        BlockWriter spillBlocks(xSize, ySize, spillBlockX, spillBlockY, sizeof(float), [&](int x0, int y0, int w, int h, const void* data)
+        {
+            return writeElevation(spillBand, x0, y0, w, h, (const float*)data, nodata, storage);
+        });
+        TileSink write = [&](int x0, int y0, int w, int h, const float* tileElev, const unsigned char* tileFlow)
+        {
+            flowBlocks.write(x0, y0, w, h, tileFlow);
+            spillBlocks.write(x0, y0, w, h, tileElev);
+        };
+        bool ok = fillTiledStreaming(xSize, ySize, read, params, write, &stats);
+        ok = flowBlocks.finish() && ok;
+        ok = spillBlocks.finish() && ok;
+        if (verbose)
+        {
+            printStats(stats);
+            printf("%.1f MB of output blocks held at most\n", (flowBlocks.peakBytes() + spillBlocks.peakBytes()) / 1048576.0);
+        }
+        GDALClose(flowDataset);
+        GDALClose(srcDataset);
+        GDALClose(spillDataset);
+        if (!ok)
+        {
+            fprintf(stderr, "Error: Tiled filling failed\n");
+            exit(EXIT_FAILURE);
+        }
+        exit(EXIT_SUCCESS);
     }
 
-    node current(0.0f, 0, 0);
-    float maxgrad, grad;
-    char dmax;
-    while (!queue.empty())
+    float *elev;
+    elev = (float *) CPLMalloc(sizeof(float)*xSize*ySize);
+    readRaster(srcBand, elev);
+    std::vector<uint64_t> checksums;
+    if (inPlace)
+        checksums = blockChecksums(srcBand, elev);
+
+    QueueTrace trace;
+    if (!trace_outfile.empty())
     {
-        current = queue.top();
-        queue.pop();
-        c = getIndex(current.x, current.y);
-        processed[c] = true;
-        queued[c] = false;
-        maxgrad = -1.0;
-        dmax = 8;
-        z = current.spill;
-        for (int d = 0; d < 8; d++)
-        {
-            nx = getNeighbourX(current.x, d);
-            ny = getNeighbourY(current.y, d);
-            n = getIndex(nx, ny);
-            if ( isInBounds(nx, ny) && !queued[n])
+        if (!trace.open(trace_outfile, xSize, ySize))
+        {
+            fprintf(stderr, "Error: Cannot open trace file %s\n", trace_outfile.c_str());
+            GDALClose(flowDataset);
+            GDALClose(srcDataset);
+            CPLFree(elev);
+            exit(EXIT_FAILURE);
+        }
+        params.trace = &trace;
+    }
+
+    std::vector<unsigned char> flowdir(xSize*ySize, 0);
+    fillEngine->fill(elev, flowdir.data(), xSize, ySize, params, &stats);
+    if (verbose)
+        printStats(stats);
+    if (!trace.close())
+    {
+        fprintf(stderr, "Error: Failed writing trace file %s\n", trace_outfile.c_str());
+    }
+
+    if (derivatives > 0)
+    {
+        const std::string* files[4] = { &slope_outfile, &aspect_outfile, &plan_outfile, &profile_outfile };
+        std::vector<float> values[4];
+        float** targets[4];
+        TerrainOutputs terrain;
+        targets[0] = &terrain.slope;
+        targets[1] = &terrain.aspect;
+        targets[2] = &terrain.plan;
+        targets[3] = &terrain.profile;
+        for (int i = 0; i < 4; i++)
+        {
+            if (!files[i]->empty())
             {
-                /*
-                if (processed[n])
-                {
-                    if (!flowdir[c] && (elev[c] - elev[n] > maxdiff))
-                    {
-                        maxdiff = elev[c] - elev[n];
-                        dmax = d;
-                    }
-                }*/
-                nz = elev[n];
-                if ( !processed[n] ) // Compute the spill elevation of the neighbour
-                {
-                    if( preserve )
-					{
-						if( nz < (z + mindiff[d]) )
-							nz = z + mindiff[d];
-					}
-					else if( nz <= z )
-					{
-						nz = z;
-                        flowdir[n] = ldd[(d+4)%8];
-					}
-                    elev[n] = nz;
-
-                    /* if (!flowdir[n] && (elev[c] > elev[n]))
-                    {
-                        flowdir[n] = d8[(d+4)%8];
-                    }
-                    elev[n] = std::max(elev[n], elev[c]);*/
-
-                    queue.push(std::move(node(nz, nx, ny)));
-                    queued[n] = true;
-                }
-                /*else if (!flowdir[c]) // Update the steepest gradient direction if needed
-                {
-                    grad = (z - nz) / length[d];
-                    if (grad > maxgrad)
-                    {
-                        maxgrad = grad;
-                        dmax = d;
-                    }
-                }*/
-                
+                values[i].resize((size_t)xSize * ySize);
+                *targets[i] = values[i].data();
             }
         }
-        if (!flowdir[c]) // Record the steepest gradient direction if needed
+        Timer timer;
+        terrainPass(elev, xSize, ySize, params, terrain, threads);
+        if (verbose)
+            printf("%-8s %.3f s\n", "terrain", timer.lap());
+        for (int i = 0; i < 4; i++)
         {
-            flowdir[c] = ldd[getFlowDir(current.x, current.y, z)];
+            if (files[i]->empty())
+                continue;
+            GDALDataset *dataset = createOutput(driver, *files[i], xSize, ySize, GDT_Float32, srcDataset, adfGeoTransform, nodata);
+            if ( dataset != nullptr )
+            {
+                writeRaster(dataset->GetRasterBand(1), values[i].data(), GDT_Float32);
+                GDALClose(dataset);
+            }
         }
     }
 
-    flowBand->RasterIO(GF_Write, 0, 0, xSize, ySize, flowdir.data(), xSize, ySize, flowBand->GetRasterDataType(), 0, 0);
-    spillBand->RasterIO(GF_Write, 0, 0, xSize, ySize, elev, xSize, ySize, spillBand->GetRasterDataType(), 0, 0);
+    if (!accum_outfile.empty())
+    {
+        GDALDataset *accumDataset = createOutput(driver, accum_outfile, xSize, ySize, GDT_UInt32, srcDataset, adfGeoTransform, 0);
+        if ( accumDataset != nullptr )
+        {
+            Timer timer;
+            std::vector<uint32_t> accum(xSize*ySize);
+            flowAccumulation(flowdir.data(), elev, nodata, xSize, ySize, accum.data(), threads, params.links, wrapX);
+            if (verbose)
+                printf("%-8s %.3f s\n", "accum", timer.lap());
+            writeRaster(accumDataset->GetRasterBand(1), accum.data(), GDT_UInt32);
+            GDALClose(accumDataset);
+        }
+    }
 
+    writeRaster(flowBand, flowdir.data(), GDT_Byte);
     GDALClose(flowDataset);
+
+    bool ok = true;
+    if (inPlace)
+    {
+        // Only the blocks holding raised cells differ from the datasource
+        size_t written;
+        ok = writeChangedBlocks(srcBand, elev, checksums, written);
+        if (verbose)
+            printf("%zu of %zu blocks rewritten\n", written, checksums.size());
+        GDALClose(srcDataset);
+        CPLFree(elev);
+        exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // Created last, a quantized output depends on the range of the filled DEM
+    if (storage.encoding == ElevationStorage::Quantized)
+    {
+        double minimum = INFINITY, maximum = -INFINITY;
+        for (size_t c = 0; c < (size_t)xSize * ySize; c++)
+        {
+            if (elev[c] != nodata)
+            {
+                minimum = std::min(minimum, (double)elev[c]);
+                maximum = std::max(maximum, (double)elev[c]);
+            }
+        }
+        ok = storage.fitRange(std::isinf(minimum) ? 0.0 : minimum, std::isinf(maximum) ? 0.0 : maximum);
+        if (!ok)
+            fprintf(stderr, "Error: Cannot quantize the filled DEM at a %g tolerance\n", storage.tolerance);
+    }
+    spillDataset = ok ? createElevationOutput(driver, spill_outfile, xSize, ySize, srcDataset, adfGeoTransform, nodata, storage) : nullptr;
+    if ( spillDataset != nullptr )
+    {
+        ok = writeElevation(spillDataset->GetRasterBand(1), 0, 0, xSize, ySize, elev, nodata, storage);
+        GDALClose(spillDataset);
+    }
+    else
+    {
+        ok = false;
+    }
     GDALClose(srcDataset);
-    GDALClose(spillDataset);
     CPLFree(elev);
-    exit(EXIT_SUCCESS);
+    exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
 }
\ No newline at end of file
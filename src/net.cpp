@@ -0,0 +1,147 @@
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <thread>
+#include "net.h"
+
+int listenTcp(const std::string& address, int port)
+{
+    addrinfo hints, *found;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(address.c_str(), std::to_string(port).c_str(), &hints, &found) != 0)
+        return -1;
+    int fd = -1;
+    for (addrinfo* a = found; a != nullptr && fd < 0; a = a->ai_next)
+    {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0)
+            continue;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, a->ai_addr, a->ai_addrlen) != 0 || listen(fd, 64) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    return fd;
+}
+
+int acceptTcp(int server)
+{
+    int fd;
+    do
+        fd = accept(server, nullptr, nullptr);
+    while (fd < 0 && errno == EINTR);
+    if (fd >= 0)
+    {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return fd;
+}
+
+int connectTcp(const std::string& host, int port, int timeout)
+{
+    addrinfo hints, *found;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0)
+        return -1;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+    int fd = -1;
+    while (fd < 0)
+    {
+        for (addrinfo* a = found; a != nullptr && fd < 0; a = a->ai_next)
+        {
+            fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+        if (fd >= 0 || std::chrono::steady_clock::now() >= deadline)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    }
+    freeaddrinfo(found);
+    if (fd >= 0)
+    {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return fd;
+}
+
+void closeTcp(int fd)
+{
+    if (fd >= 0)
+        close(fd);
+}
+
+static bool sendAll(int fd, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool receiveAll(int fd, char* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = recv(fd, data, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool sendMessage(int fd, uint32_t type, const std::vector<char>& payload)
+{
+    uint64_t size = payload.size();
+    return sendAll(fd, (const char*)&type, sizeof(type)) && sendAll(fd, (const char*)&size, sizeof(size))
+        && sendAll(fd, payload.data(), payload.size());
+}
+
+bool receiveMessage(int fd, uint32_t& type, std::vector<char>& payload)
+{
+    uint64_t size;
+    if (!receiveAll(fd, (char*)&type, sizeof(type)) || !receiveAll(fd, (char*)&size, sizeof(size))
+        || size > maxPayload)
+        return false;
+    // Grown chunk by chunk, as the bytes arrive
+    const size_t chunk = (size_t)1 << 26;
+    payload.clear();
+    while (payload.size() < size)
+    {
+        size_t start = payload.size();
+        payload.resize(start + std::min<uint64_t>(chunk, size - start));
+        if (!receiveAll(fd, payload.data() + start, payload.size() - start))
+            return false;
+    }
+    return true;
+}
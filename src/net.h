@@ -0,0 +1,105 @@
+/***************************************************************
+#                    spillDEM TCP messaging                    #
+***************************************************************/
+
+#ifndef SPILLDEM_NET_H
+#define SPILLDEM_NET_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Blocking TCP sockets, -1 on failure. The server only listens on the
+// given local address, such as 127.0.0.1, or 0.0.0.0 for all interfaces.
+int listenTcp(const std::string& address, int port);
+int acceptTcp(int server);
+// Retries for up to timeout seconds, so workers may start before the
+// coordinator
+int connectTcp(const std::string& host, int port, int timeout = 60);
+void closeTcp(int fd);
+
+// Messages are a type and a payload, sent in host byte order: the nodes of
+// a cluster are expected to share the architecture. A message announcing a
+// payload above maxPayload fails, and the payload only grows as its bytes
+// arrive, so a bad header cannot exhaust the memory.
+const uint64_t maxPayload = (uint64_t)1 << 32;
+bool sendMessage(int fd, uint32_t type, const std::vector<char>& payload);
+bool receiveMessage(int fd, uint32_t& type, std::vector<char>& payload);
+
+class MessageWriter
+{
+public:
+    template <class T>
+    void put(T value)
+    {
+        const char* p = reinterpret_cast<const char*>(&value);
+        data.insert(data.end(), p, p + sizeof(T));
+    }
+
+    template <class T>
+    void putArray(const std::vector<T>& values)
+    {
+        put<uint64_t>(values.size());
+        const char* p = reinterpret_cast<const char*>(values.data());
+        data.insert(data.end(), p, p + values.size() * sizeof(T));
+    }
+
+    void putString(const std::string& value)
+    {
+        putArray(std::vector<char>(value.begin(), value.end()));
+    }
+
+    std::vector<char> data;
+};
+
+// Reads stop at the end of the payload, leaving ok false
+class MessageReader
+{
+public:
+    explicit MessageReader(const std::vector<char>& data) : data(data) {}
+
+    template <class T>
+    T get()
+    {
+        T value = T();
+        if (pos + sizeof(T) > data.size())
+        {
+            ok = false;
+            return value;
+        }
+        memcpy(&value, data.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    template <class T>
+    void getArray(std::vector<T>& values)
+    {
+        uint64_t count = get<uint64_t>();
+        if (!ok || count > (data.size() - pos) / sizeof(T))
+        {
+            ok = false;
+            values.clear();
+            return;
+        }
+        values.resize(count);
+        memcpy(values.data(), data.data() + pos, count * sizeof(T));
+        pos += count * sizeof(T);
+    }
+
+    std::string getString()
+    {
+        std::vector<char> chars;
+        getArray(chars);
+        return std::string(chars.begin(), chars.end());
+    }
+
+    bool ok = true;
+
+private:
+    const std::vector<char>& data;
+    size_t pos = 0;
+};
+
+#endif
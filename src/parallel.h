@@ -0,0 +1,41 @@
+/***************************************************************
+#                     spillDEM parallel loops                  #
+***************************************************************/
+
+#ifndef SPILLDEM_PARALLEL_H
+#define SPILLDEM_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Call body(i) for every i in [0, count) from up to `threads` threads.
+// Items are handed out one at a time, so uneven items balance out. Runs
+// inline when a single thread is requested.
+template <class Body>
+void parallelFor(int threads, size_t count, Body body)
+{
+    threads = (int)std::min<size_t>(std::max(1, threads), count);
+    if (threads <= 1)
+    {
+        for (size_t i = 0; i < count; i++)
+            body(i);
+        return;
+    }
+    std::atomic<size_t> next(0);
+    auto worker = [&]()
+    {
+        size_t i;
+        while ((i = next.fetch_add(1, std::memory_order_relaxed)) < count)
+            body(i);
+    };
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; t++)
+        pool.push_back(std::thread(worker));
+    worker();
+    for (std::thread& t : pool)
+        t.join();
+}
+
+#endif
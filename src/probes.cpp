@@ -0,0 +1,16 @@
+#include "probes.h"
+
+#ifdef SPILLDEM_PROBES
+// One per probe, in the section the tracers look them up in. A tracer
+// raises the semaphore of a probe while it is attached to it.
+#define SPILLDEM_DEFINE_SEMAPHORE(name) \
+    volatile unsigned short SPILLDEM_SEMAPHORE(name) __attribute__((section(".probes"))) = 0
+
+SPILLDEM_DEFINE_SEMAPHORE(phase);
+SPILLDEM_DEFINE_SEMAPHORE(queue__push);
+SPILLDEM_DEFINE_SEMAPHORE(queue__pop);
+SPILLDEM_DEFINE_SEMAPHORE(tile__start);
+SPILLDEM_DEFINE_SEMAPHORE(tile__end);
+SPILLDEM_DEFINE_SEMAPHORE(io__start);
+SPILLDEM_DEFINE_SEMAPHORE(io__end);
+#endif
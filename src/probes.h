@@ -0,0 +1,55 @@
+/***************************************************************
+#                  spillDEM static tracepoints                 #
+****************************************************************
+#                                                              #
+#     USDT probes of the "spilldem" provider, for bpftrace,    #
+#   perf or systemtap. A probe is a single nop behind a test   #
+#   of its semaphore, which the tracer raises when it          #
+#   attaches, so its arguments are only computed while traced. #
+#   They are built in by default, through the SPILLDEM_PROBES  #
+#   CMake option, wherever sys/sdt.h is available. Otherwise   #
+#   the macros expand to nothing.                              #
+#                                                              #
+***************************************************************/
+
+#ifndef SPILLDEM_PROBES_H
+#define SPILLDEM_PROBES_H
+
+// Probes and their arguments:
+//   phase(name, microseconds)       end of a FillStats phase
+//   queue__push(x, y)               priority queue operations of the
+//   queue__pop(x, y)                queue based engines
+//   tile__start(t, stage)           tile t of the tiled engine, stage 0
+//   tile__end(t, stage)             when labelling, 1 when filling, 2
+//                                   when flooded again for its flats
+//   io__start(write, x0, y0, w, h)  raster window transfers, write 0
+//   io__end(write, ok)              for reads
+//
+// For instance the latency distribution of the raster writes:
+//   bpftrace -e 'usdt:./spilldem:io__start /arg0/ { @t[tid] = nsecs }
+//     usdt:./spilldem:io__end /@t[tid]/ { @us = hist((nsecs - @t[tid]) / 1000); delete(@t[tid]) }'
+#ifdef SPILLDEM_PROBES
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+// Semaphores of the probes, defined in probes.cpp
+#define SPILLDEM_SEMAPHORE(name) spilldem_##name##_semaphore
+extern volatile unsigned short SPILLDEM_SEMAPHORE(phase);
+extern volatile unsigned short SPILLDEM_SEMAPHORE(queue__push);
+extern volatile unsigned short SPILLDEM_SEMAPHORE(queue__pop);
+extern volatile unsigned short SPILLDEM_SEMAPHORE(tile__start);
+extern volatile unsigned short SPILLDEM_SEMAPHORE(tile__end);
+extern volatile unsigned short SPILLDEM_SEMAPHORE(io__start);
+extern volatile unsigned short SPILLDEM_SEMAPHORE(io__end);
+
+#define SPILLDEM_PROBE_ENABLED(name) __builtin_expect(SPILLDEM_SEMAPHORE(name) != 0, 0)
+#define SPILLDEM_PROBE2(name, a, b) \
+    do { if (SPILLDEM_PROBE_ENABLED(name)) DTRACE_PROBE2(spilldem, name, a, b); } while (0)
+#define SPILLDEM_PROBE5(name, a, b, c, d, e) \
+    do { if (SPILLDEM_PROBE_ENABLED(name)) DTRACE_PROBE5(spilldem, name, a, b, c, d, e); } while (0)
+#else
+#define SPILLDEM_PROBE2(name, a, b) do {} while (0)
+#define SPILLDEM_PROBE5(name, a, b, c, d, e) do {} while (0)
+#endif
+
+#endif
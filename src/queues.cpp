@@ -0,0 +1,32 @@
+#include "queues.h"
+
+const std::vector<QueueKind>& queueKinds()
+{
+    static const std::vector<QueueKind> kinds = { QueueKind::Binary, QueueKind::Quaternary };
+    return kinds;
+}
+
+const char* queueKindName(QueueKind kind)
+{
+    switch (kind)
+    {
+    case QueueKind::Binary:
+        return "binary";
+    case QueueKind::Quaternary:
+        return "quaternary";
+    }
+    return "unknown";
+}
+
+bool parseQueueKind(const std::string& name, QueueKind& kind)
+{
+    for (QueueKind k : queueKinds())
+    {
+        if (name == queueKindName(k))
+        {
+            kind = k;
+            return true;
+        }
+    }
+    return false;
+}
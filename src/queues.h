@@ -0,0 +1,87 @@
+/***************************************************************
+#                       spillDEM queues                        #
+****************************************************************
+#                                                              #
+#     Priority queue implementations usable by the flood.      #
+#   All of them follow the std::priority_queue interface so    #
+#   the engines and the trace replay can be templated on them. #
+#                                                              #
+***************************************************************/
+
+#ifndef SPILLDEM_QUEUES_H
+#define SPILLDEM_QUEUES_H
+
+#include <algorithm>
+#include <queue>
+#include <string>
+#include <vector>
+
+enum class QueueKind
+{
+    Binary,     // std::priority_queue, binary heap over std::vector
+    Quaternary  // 4-ary implicit heap
+};
+
+// Map between queue kinds and their command line names
+bool parseQueueKind(const std::string& name, QueueKind& kind);
+const char* queueKindName(QueueKind kind);
+const std::vector<QueueKind>& queueKinds();
+
+// D-ary implicit heap. A wider fan-out halves the depth of the heap and
+// keeps the children of a node on the same cache line, at the price of
+// more comparisons per level when popping.
+template <class T, int D>
+class DaryHeap
+{
+public:
+    bool empty() const { return heap.empty(); }
+    size_t size() const { return heap.size(); }
+    const T& top() const { return heap.front(); }
+
+    void push(const T& value)
+    {
+        size_t i = heap.size();
+        heap.push_back(value);
+        while (i > 0)
+        {
+            size_t parent = (i - 1) / D;
+            if (!(heap[parent] < value))
+                break;
+            heap[i] = heap[parent];
+            i = parent;
+        }
+        heap[i] = value;
+    }
+
+    void pop()
+    {
+        T value = heap.back();
+        heap.pop_back();
+        const size_t n = heap.size();
+        if (n == 0)
+            return;
+        size_t i = 0;
+        for (;;)
+        {
+            size_t first = i * D + 1;
+            if (first >= n)
+                break;
+            size_t last = std::min(first + D, n), best = first;
+            for (size_t c = first + 1; c < last; c++)
+            {
+                if (heap[best] < heap[c])
+                    best = c;
+            }
+            if (!(value < heap[best]))
+                break;
+            heap[i] = heap[best];
+            i = best;
+        }
+        heap[i] = value;
+    }
+
+private:
+    std::vector<T> heap;
+};
+
+#endif
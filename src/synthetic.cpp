@@ -0,0 +1,38 @@
+#include <algorithm>
+#include "synthetic.h"
+
+static float latticeValue(int x, int y, uint32_t seed)
+{
+    uint32_t h = seed ^ ((uint32_t)x * 0x27d4eb2d) ^ ((uint32_t)y * 0x165667b1);
+    h ^= h >> 15;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return (h & 0xffffff) / float(0xffffff);
+}
+
+void generateDEM(float* elev, int xSize, int ySize, uint32_t seed)
+{
+    const int octaves = 6;
+    for (int y = 0; y < ySize; y++)
+    {
+        for (int x = 0; x < xSize; x++)
+        {
+            float z = 0.0f, amplitude = 100.0f;
+            int period = 256;
+            for (int o = 0; o < octaves; o++)
+            {
+                int gx = x / period, gy = y / period;
+                float fx = float(x % period) / period, fy = float(y % period) / period;
+                uint32_t s = seed + o;
+                float top = latticeValue(gx, gy, s) * (1 - fx) + latticeValue(gx + 1, gy, s) * fx;
+                float bottom = latticeValue(gx, gy + 1, s) * (1 - fx) + latticeValue(gx + 1, gy + 1, s) * fx;
+                z += amplitude * (top * (1 - fy) + bottom * fy);
+                amplitude *= 0.5f;
+                period = std::max(1, period / 2);
+            }
+            elev[(size_t)y * xSize + x] = z;
+        }
+    }
+}
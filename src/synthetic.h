@@ -0,0 +1,14 @@
+/***************************************************************
+#                    spillDEM synthetic DEMs                   #
+***************************************************************/
+
+#ifndef SPILLDEM_SYNTHETIC_H
+#define SPILLDEM_SYNTHETIC_H
+
+#include <cstdint>
+
+// Hash based value noise, summed over octaves. Gives rough terrain with
+// depressions at every scale, deterministic for a given seed.
+void generateDEM(float* elev, int xSize, int ySize, uint32_t seed);
+
+#endif
@@ -0,0 +1,174 @@
+#include <sched.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sysinfo.h"
+
+struct cgroupentry
+{
+    std::string controllers; // empty for the cgroup v2 unified hierarchy
+    std::string path;
+};
+
+// Entries of /proc/self/cgroup, "hierarchy-id:controllers:path"
+static std::vector<cgroupentry> readCgroups()
+{
+    std::vector<cgroupentry> entries;
+    std::ifstream file("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(file, line))
+    {
+        size_t first = line.find(':'), second = line.find(':', first + 1);
+        if (first == std::string::npos || second == std::string::npos)
+            continue;
+        cgroupentry e;
+        e.controllers = line.substr(first + 1, second - first - 1);
+        e.path = line.substr(second + 1);
+        entries.push_back(e);
+    }
+    return entries;
+}
+
+static bool readFile(const std::string& path, std::string& content)
+{
+    std::ifstream file(path.c_str());
+    if (!file)
+        return false;
+    std::getline(file, content);
+    return true;
+}
+
+// Directories holding the limits of the cgroup, from the cgroup itself up to
+// the root of its hierarchy. Inside a container the cgroup path is often not
+// visible and the container's own cgroup is mounted as the root, which the
+// last entry covers.
+static std::vector<std::string> cgroupDirs(const std::string& mount, const std::string& path)
+{
+    std::vector<std::string> dirs;
+    std::string p = path;
+    while (!p.empty() && p != "/")
+    {
+        dirs.push_back(mount + p);
+        p = p.substr(0, p.rfind('/'));
+    }
+    dirs.push_back(mount);
+    return dirs;
+}
+
+static bool hasController(const std::string& controllers, const char* name)
+{
+    std::stringstream list(controllers);
+    std::string c;
+    while (std::getline(list, c, ','))
+    {
+        if (c == name)
+            return true;
+    }
+    return false;
+}
+
+// Smallest CPU quota of the cgroup hierarchies, in CPUs, 0 when unlimited
+static double cgroupCpuQuota()
+{
+    double quota = 0.0;
+    auto limit = [&](double q)
+    {
+        if (q > 0.0 && (quota == 0.0 || q < quota))
+            quota = q;
+    };
+    for (const cgroupentry& e : readCgroups())
+    {
+        std::string content;
+        if (e.controllers.empty())
+        {
+            // v2: cpu.max holds "max 100000" or "<quota> <period>"
+            for (const std::string& dir : cgroupDirs("/sys/fs/cgroup", e.path))
+            {
+                char max[32];
+                double period;
+                if (readFile(dir + "/cpu.max", content)
+                    && sscanf(content.c_str(), "%31s %lf", max, &period) == 2 && strcmp(max, "max") != 0)
+                    limit(std::atof(max) / period);
+            }
+        }
+        else if (hasController(e.controllers, "cpu"))
+        {
+            // v1: cpu.cfs_quota_us is -1 when unlimited
+            for (const char* mount : { "/sys/fs/cgroup/cpu,cpuacct", "/sys/fs/cgroup/cpu" })
+            {
+                for (const std::string& dir : cgroupDirs(mount, e.path))
+                {
+                    std::string period;
+                    if (readFile(dir + "/cpu.cfs_quota_us", content) && readFile(dir + "/cpu.cfs_period_us", period)
+                        && std::atof(content.c_str()) > 0 && std::atof(period.c_str()) > 0)
+                        limit(std::atof(content.c_str()) / std::atof(period.c_str()));
+                }
+            }
+        }
+    }
+    return quota;
+}
+
+// Smallest memory limit of the cgroup hierarchies, 0 when unlimited
+static uint64_t cgroupMemoryLimit()
+{
+    uint64_t memory = 0;
+    auto limit = [&](const std::string& content)
+    {
+        char* end;
+        unsigned long long m = std::strtoull(content.c_str(), &end, 10);
+        // v1 reports "unlimited" as a huge page-aligned value
+        if (end != content.c_str() && m > 0 && m < (1ULL << 62) && (memory == 0 || m < memory))
+            memory = m;
+    };
+    for (const cgroupentry& e : readCgroups())
+    {
+        std::string content;
+        if (e.controllers.empty())
+        {
+            for (const std::string& dir : cgroupDirs("/sys/fs/cgroup", e.path))
+            {
+                if (readFile(dir + "/memory.max", content) && content != "max")
+                    limit(content);
+            }
+        }
+        else if (hasController(e.controllers, "memory"))
+        {
+            for (const std::string& dir : cgroupDirs("/sys/fs/cgroup/memory", e.path))
+            {
+                if (readFile(dir + "/memory.limit_in_bytes", content))
+                    limit(content);
+            }
+        }
+    }
+    return memory;
+}
+
+int availableCpus()
+{
+    int cpus = std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        cpus = std::min(cpus, std::max(1, CPU_COUNT(&set)));
+    double quota = cgroupCpuQuota();
+    if (quota > 0.0)
+        cpus = std::min(cpus, std::max(1, (int)std::ceil(quota)));
+    return cpus;
+}
+
+uint64_t availableMemory()
+{
+    uint64_t memory = (uint64_t)sysconf(_SC_PHYS_PAGES) * (uint64_t)sysconf(_SC_PAGE_SIZE);
+    uint64_t limit = cgroupMemoryLimit();
+    if (limit > 0)
+        memory = std::min(memory, limit);
+    return memory;
+}
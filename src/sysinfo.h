@@ -0,0 +1,26 @@
+/***************************************************************
+#                    spillDEM system resources                 #
+****************************************************************
+#                                                              #
+#     CPU and memory actually available to the process. In     #
+#   containers the cgroup CPU quota and memory limit are much  #
+#   lower than what the host reports, and sizing threads or    #
+#   buffers after the host gets the process throttled or       #
+#   killed.                                                    #
+#                                                              #
+***************************************************************/
+
+#ifndef SPILLDEM_SYSINFO_H
+#define SPILLDEM_SYSINFO_H
+
+#include <cstdint>
+
+// CPUs the process may use: the smallest of the online CPUs, the CPU
+// affinity mask and the cgroup v1/v2 CPU quota, rounded up
+int availableCpus();
+
+// Bytes of memory the process may use: the smallest of the physical
+// memory and the cgroup v1/v2 memory limits
+uint64_t availableMemory();
+
+#endif
@@ -0,0 +1,110 @@
+#include <cmath>
+#include <vector>
+#include "parallel.h"
+#include "terrain.h"
+
+void terrainPass(const float* elev, int xSize, int ySize,
+                 const FillParams& params, const TerrainOutputs& out, int threads)
+{
+    const float nodata = params.nodata;
+    const float dx = std::fabs(params.pixelSizeX), dy = std::fabs(params.pixelSizeY);
+    const float toDegrees = 180.0 / M_PI;
+    const int rowsPerItem = 64;
+    // Past the east and west edges, either outside or around the globe
+    const bool wrapX = params.wrapX;
+    auto wrap = [&](int x){ return !wrapX ? x : x < 0 ? x + xSize : x >= xSize ? x - xSize : x; };
+
+    parallelFor(threads, (ySize + rowsPerItem - 1) / rowsPerItem, [&](size_t item)
+    {
+        // The three rows of the window, padded by one cell on each side
+        std::vector<float> rows[3];
+        for (int r = 0; r < 3; r++)
+            rows[r].resize(xSize + 2);
+        std::vector<unsigned char> missing(xSize + 2);
+        std::vector<float> p(xSize), q(xSize);
+
+        const int y0 = item * rowsPerItem, y1 = std::min(ySize, y0 + rowsPerItem);
+        for (int y = y0; y < y1; y++)
+        {
+            const float* centre = elev + (size_t)y * xSize;
+            for (int r = 0; r < 3; r++)
+            {
+                int ny = y + r - 1;
+                const float* src = (ny >= 0 && ny < ySize) ? elev + (size_t)ny * xSize : centre;
+                std::copy(src, src + xSize, rows[r].begin() + 1);
+                rows[r][0] = rows[r][wrapX ? xSize : 1];
+                rows[r][xSize + 1] = rows[r][wrapX ? 1 : xSize];
+            }
+            const float* n = rows[0].data();
+            const float* c = rows[1].data();
+            const float* s = rows[2].data();
+            // Windows reaching outside the DEM or nodata cells are flagged
+            // and redone in a scalar loop
+            const bool edgeRow = y == 0 || y == ySize - 1;
+            for (int x = 0; x < xSize + 2; x++)
+            {
+                missing[x] = edgeRow || (!wrapX && (x == 0 || x == xSize + 1))
+                          || n[x] == nodata || c[x] == nodata || s[x] == nodata;
+            }
+
+            // Horn gradients, branch free so that the loop vectorises
+            for (int x = 0; x < xSize; x++)
+            {
+                p[x] = ((n[x + 2] + 2 * c[x + 2] + s[x + 2]) - (n[x] + 2 * c[x] + s[x])) / (8 * dx);
+                q[x] = ((s[x] + 2 * s[x + 1] + s[x + 2]) - (n[x] + 2 * n[x + 1] + n[x + 2])) / (8 * dy);
+            }
+            const size_t row = (size_t)y * xSize;
+            for (int x = 0; x < xSize; x++)
+            {
+                float z = c[x + 1];
+                float w[9] = { n[x], n[x + 1], n[x + 2], c[x], z, c[x + 2], s[x], s[x + 1], s[x + 2] };
+                if (z == nodata)
+                {
+                    if (out.slope) out.slope[row + x] = nodata;
+                    if (out.aspect) out.aspect[row + x] = nodata;
+                    if (out.plan) out.plan[row + x] = nodata;
+                    if (out.profile) out.profile[row + x] = nodata;
+                    continue;
+                }
+                if (missing[x] || missing[x + 1] || missing[x + 2])
+                {
+                    for (int k = 0; k < 9; k++)
+                    {
+                        int nx = wrap(x + k % 3 - 1), ny = y + k / 3 - 1;
+                        if (nx < 0 || nx >= xSize || ny < 0 || ny >= ySize || w[k] == nodata)
+                            w[k] = z;
+                    }
+                    p[x] = ((w[2] + 2 * w[5] + w[8]) - (w[0] + 2 * w[3] + w[6])) / (8 * dx);
+                    q[x] = ((w[6] + 2 * w[7] + w[8]) - (w[0] + 2 * w[1] + w[2])) / (8 * dy);
+                }
+                if (out.slope)
+                    out.slope[row + x] = std::atan(std::sqrt(p[x] * p[x] + q[x] * q[x])) * toDegrees;
+                if (out.aspect)
+                {
+                    float a = nodata;
+                    if (p[x] != 0.0f || q[x] != 0.0f)
+                    {
+                        a = std::atan2(q[x], -p[x]) * toDegrees;
+                        a = a > 90.0f ? 450.0f - a : 90.0f - a;
+                        if (a == 360.0f)
+                            a = 0.0f;
+                    }
+                    out.aspect[row + x] = a;
+                }
+                if (out.plan || out.profile)
+                {
+                    float D = ((w[3] + w[5]) / 2 - z) / (dx * dx);
+                    float E = ((w[1] + w[7]) / 2 - z) / (dy * dy);
+                    float F = (-w[0] + w[2] + w[6] - w[8]) / (4 * dx * dy);
+                    float G = (-w[3] + w[5]) / (2 * dx);
+                    float H = (w[1] - w[7]) / (2 * dy);
+                    float g2 = G * G + H * H;
+                    if (out.profile)
+                        out.profile[row + x] = g2 > 0.0f ? -2 * (D * G * G + E * H * H + F * G * H) / g2 : 0.0f;
+                    if (out.plan)
+                        out.plan[row + x] = g2 > 0.0f ? 2 * (D * H * H + E * G * G - F * G * H) / g2 : 0.0f;
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,29 @@
+/***************************************************************
+#                  spillDEM terrain derivatives                #
+***************************************************************/
+
+#ifndef SPILLDEM_TERRAIN_H
+#define SPILLDEM_TERRAIN_H
+
+#include "fill.h"
+
+// Optional outputs of the terrain pass, left out when null. Cells where
+// the DEM is nodata get nodata.
+struct TerrainOutputs
+{
+    float* slope = nullptr;   // degrees (Horn 1981, as gdaldem slope)
+    float* aspect = nullptr;  // degrees clockwise from north, nodata on flats (as gdaldem aspect)
+    float* plan = nullptr;    // plan curvature, positive when convex across the slope
+    float* profile = nullptr; // profile curvature, negative when convex along the slope
+};
+
+// One row-parallel pass over the filled DEM reading every 3 x 3 window
+// once and filling the requested derivatives. The flow directions are the
+// engine's, whatever outputs are requested. Curvatures follow Zevenbergen
+// & Thorne (1987), in 1 / map unit.
+// Neighbours outside the DEM or nodata take the value of the centre cell,
+// the east and west edges being neighbours with params.wrapX.
+void terrainPass(const float* elev, int xSize, int ySize,
+                 const FillParams& params, const TerrainOutputs& out, int threads);
+
+#endif
@@ -0,0 +1,901 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
+#include "parallel.h"
+#include "probes.h"
+#include "tiles.h"
+
+static const char graphMagic[4] = {'S', 'P', 'T', 'G'};
+static const uint32_t graphVersion = 2;
+// Label shared by every cell draining to the DEM edge or to nodata
+static const uint32_t oceanLabel = 1;
+// Rank of the flats no tile drains, left with the directions of the flood
+static const uint32_t unranked = std::numeric_limits<uint32_t>::max();
+// Saved graphs are read by concurrent tiles
+static std::mutex fileLock;
+
+TileLayout::TileLayout(int xSize, int ySize, int tileSize)
+    : xSize(xSize), ySize(ySize), tileSize(tileSize),
+      xTiles((xSize + tileSize - 1) / tileSize), yTiles((ySize + tileSize - 1) / tileSize)
+{}
+
+void TileLayout::window(int t, int& x0, int& y0, int& w, int& h) const
+{
+    x0 = (t % xTiles) * tileSize;
+    y0 = (t / xTiles) * tileSize;
+    w = std::min(tileSize, xSize - x0);
+    h = std::min(tileSize, ySize - y0);
+}
+
+static size_t perimeterLength(int w, int h)
+{
+    return 2 * (size_t)w + 2 * (size_t)h;
+}
+
+// Position of a perimeter cell of a w x h tile in the perimeter arrays
+static size_t perimeterSlot(int w, int h, int lx, int ly)
+{
+    if (ly == 0)
+        return lx;
+    if (ly == h - 1)
+        return w + lx;
+    if (lx == 0)
+        return 2 * (size_t)w + ly;
+    return 2 * (size_t)w + h + ly;
+}
+
+// Store the value of a perimeter cell on every side it belongs to
+template <class T>
+static void setPerimeter(std::vector<T>& values, int w, int h, int lx, int ly, T value)
+{
+    if (ly == 0)
+        values[lx] = value;
+    if (ly == h - 1)
+        values[w + lx] = value;
+    if (lx == 0)
+        values[2 * (size_t)w + ly] = value;
+    if (lx == w - 1)
+        values[2 * (size_t)w + h + ly] = value;
+}
+
+// Priority-flood one tile from its perimeter, giving a label to the
+// watershed of each perimeter cell and recording the lowest spill
+// elevation between every pair of touching watersheds. halo holds the tile
+// with a one cell border, nodata outside the DEM.
+static void labelTile(const float* halo, int w, int h, float nodata, TileSummary& out)
+{
+    const int hw = w + 2;
+    auto getElev = [&](int lx, int ly){ return halo[(size_t)(ly + 1) * hw + lx + 1]; };
+    auto getIndex = [&](int lx, int ly){ return (size_t)ly * w + lx; };
+    auto isInTile = [&](int lx, int ly){ return lx >= 0 && lx < w && ly >= 0 && ly < h; };
+
+    std::vector<uint32_t> label((size_t)w * h, 0);
+    std::vector<float> filled((size_t)w * h);
+    std::vector<bool> queued((size_t)w * h, false);
+    std::priority_queue<node> queue;
+    std::queue<node> flat; // cells at the level being processed, as in the pq engine
+    std::unordered_map<uint64_t, float> edges;
+    uint32_t next = oceanLabel + 1;
+    float z;
+
+    for (int ly = 0; ly < h; ly++)
+    {
+        for (int lx = 0; lx < w; lx++)
+        {
+            z = getElev(lx, ly);
+            if (z == nodata)
+                continue;
+            bool outlet = false;
+            for (int d = 0; d < 8 && !outlet; d++)
+                outlet = getElev(lx + ngh[d].dx, ly + ngh[d].dy) == nodata;
+            if (outlet || lx == 0 || ly == 0 || lx == w - 1 || ly == h - 1)
+            {
+                size_t c = getIndex(lx, ly);
+                filled[c] = z;
+                queued[c] = true;
+                if (outlet)
+                    label[c] = oceanLabel;
+                queue.push(node(z, lx, ly));
+            }
+        }
+    }
+
+    while (!flat.empty() || !queue.empty())
+    {
+        node current(0.0f, 0, 0);
+        if (!flat.empty())
+        {
+            current = flat.front();
+            flat.pop();
+        }
+        else
+        {
+            current = queue.top();
+            queue.pop();
+        }
+        size_t c = getIndex(current.x, current.y);
+        if (label[c] == 0)
+            label[c] = next++;
+        z = current.spill;
+        for (int d = 0; d < 8; d++)
+        {
+            int nx = current.x + ngh[d].dx, ny = current.y + ngh[d].dy;
+            if (!isInTile(nx, ny) || getElev(nx, ny) == nodata)
+                continue;
+            size_t n = getIndex(nx, ny);
+            if (!queued[n])
+            {
+                label[n] = label[c];
+                filled[n] = std::max(getElev(nx, ny), z);
+                queued[n] = true;
+                if (filled[n] == z)
+                    flat.push(node(z, nx, ny));
+                else
+                    queue.push(node(filled[n], nx, ny));
+            }
+            else if (label[n] != 0 && label[n] != label[c])
+            {
+                uint32_t a = std::min(label[c], label[n]), b = std::max(label[c], label[n]);
+                uint64_t key = (uint64_t)a << 32 | b;
+                float spill = std::max(z, filled[n]);
+                auto it = edges.find(key);
+                if (it == edges.end())
+                    edges[key] = spill;
+                else
+                    it->second = std::min(it->second, spill);
+            }
+        }
+    }
+
+    out.labels = next - 1;
+    out.sideLabels.assign(perimeterLength(w, h), 0);
+    out.sideElev.assign(perimeterLength(w, h), nodata);
+    for (int ly = 0; ly < h; ly++)
+    {
+        for (int lx = 0; lx < w; lx += (ly == 0 || ly == h - 1) ? 1 : std::max(1, w - 1))
+        {
+            setPerimeter(out.sideLabels, w, h, lx, ly, label[getIndex(lx, ly)]);
+            setPerimeter(out.sideElev, w, h, lx, ly, getElev(lx, ly));
+        }
+    }
+    out.edges.assign(edges.begin(), edges.end());
+}
+
+// Flats of a flooded tile crossing its edge, in halo coordinates: flat
+// receives the flat of every cell, 0 for none, cells the cells of every
+// flat in turn and exits whether each flat drains within the tile, to a
+// lower cell or an outlet. Returns the number of flats.
+static uint32_t findFlats(const std::vector<float>& halo, const std::vector<unsigned char>& haloFlow,
+                          int w, int h, float nodata, std::vector<uint32_t>& flat,
+                          std::vector<size_t>& cells, std::vector<unsigned char>& exits)
+{
+    const int hw = w + 2;
+    auto isInTile = [&](int hx, int hy){ return hx >= 1 && hx <= w && hy >= 1 && hy <= h; };
+    flat.assign(halo.size(), 0);
+    cells.clear();
+    exits.clear();
+    for (int ly = 0; ly < h; ly++)
+    {
+        for (int lx = 0; lx < w; lx += (ly == 0 || ly == h - 1) ? 1 : std::max(1, w - 1))
+        {
+            size_t c = (size_t)(ly + 1) * hw + lx + 1;
+            float z = halo[c];
+            if (z == nodata || flat[c])
+                continue;
+            bool crossing = false;
+            for (int d = 0; d < 8 && !crossing; d++)
+            {
+                int nx = lx + 1 + ngh[d].dx, ny = ly + 1 + ngh[d].dy;
+                crossing = !isInTile(nx, ny) && halo[(size_t)ny * hw + nx] == z;
+            }
+            if (!crossing)
+                continue;
+            exits.push_back(0);
+            const uint32_t id = exits.size();
+            flat[c] = id;
+            cells.push_back(c);
+            for (size_t i = cells.size() - 1; i < cells.size(); i++)
+            {
+                size_t m = cells[i];
+                int mx = m % hw, my = m / hw;
+                if (haloFlow[m] == 255)
+                    exits.back() = 1;
+                for (int d = 0; d < 8; d++)
+                {
+                    int nx = mx + ngh[d].dx, ny = my + ngh[d].dy;
+                    size_t n = (size_t)ny * hw + nx;
+                    if (halo[n] == nodata)
+                        continue;
+                    if (halo[n] < z)
+                        exits.back() = 1;
+                    else if (halo[n] == z && isInTile(nx, ny) && !flat[n])
+                    {
+                        flat[n] = id;
+                        cells.push_back(n);
+                    }
+                }
+            }
+        }
+    }
+    return exits.size();
+}
+
+TileGraph::~TileGraph()
+{
+    if (file)
+        fclose(file);
+}
+
+void TileGraph::computeOffsets()
+{
+    offsets.assign(tiles.count() + 1, 0);
+    int x0, y0, w, h;
+    for (int t = 0; t < tiles.count(); t++)
+    {
+        tiles.window(t, x0, y0, w, h);
+        offsets[t + 1] = offsets[t] + perimeterLength(w, h);
+    }
+}
+
+bool summarizeTile(const TileLayout& tiles, int t, const WindowReader& read, float nodata, TileSummary& out)
+{
+    int x0, y0, w, h;
+    tiles.window(t, x0, y0, w, h);
+    // Read the tile with a one cell border, clipped to the DEM
+    int rx0 = std::max(0, x0 - 1), ry0 = std::max(0, y0 - 1);
+    int rw = std::min(tiles.xSize, x0 + w + 1) - rx0, rh = std::min(tiles.ySize, y0 + h + 1) - ry0;
+    std::vector<float> window((size_t)rw * rh);
+    if (!read(rx0, ry0, rw, rh, window.data()))
+        return false;
+    std::vector<float> halo((size_t)(w + 2) * (h + 2), nodata);
+    for (int y = 0; y < rh; y++)
+    {
+        std::copy(window.begin() + (size_t)y * rw, window.begin() + (size_t)(y + 1) * rw,
+                  halo.begin() + (size_t)(ry0 + y - y0 + 1) * (w + 2) + (rx0 - x0 + 1));
+    }
+    SPILLDEM_PROBE2(tile__start, t, 0);
+    labelTile(halo.data(), w, h, nodata, out);
+    SPILLDEM_PROBE2(tile__end, t, 0);
+    return true;
+}
+
+bool TileGraph::build(const TileLayout& layout, const WindowReader& read, float nodata, int threads,
+                      FillStats* stats)
+{
+    Timer timer;
+
+    // Label every tile on its own
+    std::vector<TileSummary> summaries(layout.count());
+    std::atomic<bool> ok(true);
+    parallelFor(threads, layout.count(), [&](size_t t)
+    {
+        if (ok && !summarizeTile(layout, t, read, nodata, summaries[t]))
+            ok = false;
+    });
+    if (!ok)
+        return false;
+    if (stats)
+        stats->addPhase("label", timer.lap());
+
+    solve(layout, nodata, summaries);
+    if (stats)
+        stats->addPhase("solve", timer.lap());
+
+    // Flats crossing tile edges, the tiles holding them flooded again
+    std::vector<FlatSummary> flats(layout.count());
+    parallelFor(threads, layout.count(), [&](size_t t)
+    {
+        if (ok && crossesFlat(t) && !summarizeFlats(t, read, flats[t]))
+            ok = false;
+    });
+    if (!ok)
+        return false;
+    solveFlats(flats);
+    if (stats)
+        stats->addPhase("flats", timer.lap());
+    return true;
+}
+
+void TileGraph::reset(const TileLayout& layout, float nodata)
+{
+    if (file)
+        fclose(file);
+    file = nullptr;
+    tiles = layout;
+    nodataValue = nodata;
+    computeOffsets();
+    perimeter.assign(offsets.back(), nodata);
+    flatRank.assign(offsets.back(), 0);
+}
+
+void TileGraph::solve(const TileLayout& layout, float nodata, const std::vector<TileSummary>& summaries)
+{
+    reset(layout, nodata);
+
+    // Number the labels globally, the ocean label being shared
+    std::vector<uint32_t> base(tiles.count());
+    uint32_t labels = oceanLabel + 1;
+    for (int t = 0; t < tiles.count(); t++)
+    {
+        base[t] = labels - (oceanLabel + 1);
+        labels += summaries[t].labels - oceanLabel;
+    }
+    auto global = [&](int t, uint32_t l){ return l == oceanLabel ? oceanLabel : base[t] + l; };
+
+    struct spilledge
+    {
+        uint32_t a, b;
+        float spill;
+    };
+    std::vector<spilledge> edges;
+    for (int t = 0; t < tiles.count(); t++)
+    {
+        const TileSummary& s = summaries[t];
+        for (const auto& e : s.edges)
+            edges.push_back({global(t, e.first >> 32), global(t, e.first & 0xffffffff), e.second});
+
+        // Join the perimeter cells to those of the following tiles
+        int x0, y0, w, h;
+        tiles.window(t, x0, y0, w, h);
+        for (int ly = 0; ly < h; ly++)
+        {
+            for (int lx = 0; lx < w; lx += (ly == 0 || ly == h - 1) ? 1 : std::max(1, w - 1))
+            {
+                size_t p = perimeterSlot(w, h, lx, ly);
+                if (s.sideLabels[p] == 0)
+                    continue;
+                for (int d = 0; d < 8; d++)
+                {
+                    int x = x0 + lx + ngh[d].dx, y = y0 + ly + ngh[d].dy;
+                    if (x < 0 || x >= tiles.xSize || y < 0 || y >= tiles.ySize)
+                        continue;
+                    int tn = tiles.tileAt(x, y);
+                    if (tn <= t)
+                        continue;
+                    int nx0, ny0, nw, nh;
+                    tiles.window(tn, nx0, ny0, nw, nh);
+                    size_t q = perimeterSlot(nw, nh, x - nx0, y - ny0);
+                    const TileSummary& sn = summaries[tn];
+                    if (sn.sideLabels[q] == 0)
+                        continue;
+                    edges.push_back({global(t, s.sideLabels[p]), global(tn, sn.sideLabels[q]),
+                                     std::max(s.sideElev[p], sn.sideElev[q])});
+                }
+            }
+        }
+    }
+
+    // Adjacency lists in compressed rows
+    std::vector<size_t> first(labels + 1, 0);
+    for (const spilledge& e : edges)
+    {
+        first[e.a + 1]++;
+        first[e.b + 1]++;
+    }
+    for (uint32_t l = 0; l < labels; l++)
+        first[l + 1] += first[l];
+    std::vector<std::pair<uint32_t, float>> adjacent(first[labels]);
+    std::vector<size_t> fill(first.begin(), first.end() - 1);
+    for (const spilledge& e : edges)
+    {
+        adjacent[fill[e.a]++] = std::make_pair(e.b, e.spill);
+        adjacent[fill[e.b]++] = std::make_pair(e.a, e.spill);
+    }
+    std::vector<spilledge>().swap(edges);
+
+    // Lowest spill elevation from every label to the ocean
+    typedef std::pair<float, uint32_t> entry;
+    std::priority_queue<entry, std::vector<entry>, std::greater<entry>> queue;
+    std::vector<float> spill(labels, std::numeric_limits<float>::infinity());
+    spill[oceanLabel] = -std::numeric_limits<float>::infinity();
+    queue.push(entry(spill[oceanLabel], oceanLabel));
+    while (!queue.empty())
+    {
+        entry current = queue.top();
+        queue.pop();
+        if (current.first > spill[current.second])
+            continue;
+        for (size_t i = first[current.second]; i < first[current.second + 1]; i++)
+        {
+            float s = std::max(current.first, adjacent[i].second);
+            if (s < spill[adjacent[i].first])
+            {
+                spill[adjacent[i].first] = s;
+                queue.push(entry(s, adjacent[i].first));
+            }
+        }
+    }
+
+    for (int t = 0; t < tiles.count(); t++)
+    {
+        const TileSummary& s = summaries[t];
+        for (size_t p = 0; p < s.sideLabels.size(); p++)
+        {
+            if (s.sideLabels[p] != 0)
+            {
+                float level = spill[global(t, s.sideLabels[p])];
+                perimeter[offsets[t] + p] = std::isinf(level) && level > 0 ? s.sideElev[p]
+                                                                           : std::max(s.sideElev[p], level);
+            }
+        }
+    }
+}
+
+bool TileGraph::crossesFlat(int t) const
+{
+    int x0, y0, w, h;
+    tiles.window(t, x0, y0, w, h);
+    // Perimeters of the tile and of its neighbours, by offset
+    std::vector<float> values[9];
+    const int tx = t % tiles.xTiles, ty = t / tiles.xTiles;
+    for (int k = 0; k < 9; k++)
+    {
+        int nx = tx + k % 3 - 1, ny = ty + k / 3 - 1;
+        if (nx >= 0 && nx < tiles.xTiles && ny >= 0 && ny < tiles.yTiles
+            && !tilePerimeter(ny * tiles.xTiles + nx, values[k]))
+            return false;
+    }
+    for (int ly = 0; ly < h; ly++)
+    {
+        for (int lx = 0; lx < w; lx += (ly == 0 || ly == h - 1) ? 1 : std::max(1, w - 1))
+        {
+            float z = values[4][perimeterSlot(w, h, lx, ly)];
+            if (z == nodataValue)
+                continue;
+            for (int d = 0; d < 8; d++)
+            {
+                int x = x0 + lx + ngh[d].dx, y = y0 + ly + ngh[d].dy;
+                if (x < 0 || x >= tiles.xSize || y < 0 || y >= tiles.ySize)
+                    continue;
+                int k = (y < y0 ? 0 : y < y0 + h ? 3 : 6) + (x < x0 ? 0 : x < x0 + w ? 1 : 2);
+                if (k == 4)
+                    continue;
+                int nx0, ny0, nw, nh;
+                tiles.window(tiles.tileAt(x, y), nx0, ny0, nw, nh);
+                if (values[k][perimeterSlot(nw, nh, x - nx0, y - ny0)] == z)
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool TileGraph::summarizeFlats(int t, const WindowReader& read, FlatSummary& out) const
+{
+    int x0, y0, w, h;
+    tiles.window(t, x0, y0, w, h);
+    FillParams params;
+    params.minslope = 0.0f;
+    params.nodata = nodataValue;
+    std::vector<float> elev((size_t)w * h), halo;
+    std::vector<unsigned char> haloFlow;
+    if (!floodTile(t, read, params, 2, elev.data(), halo, haloFlow, nullptr))
+        return false;
+    std::vector<uint32_t> flat;
+    std::vector<size_t> cells;
+    out.sideFlats.clear();
+    if (!findFlats(halo, haloFlow, w, h, nodataValue, flat, cells, out.exits))
+        return true;
+    out.sideFlats.assign(perimeterLength(w, h), 0);
+    for (int ly = 0; ly < h; ly++)
+    {
+        for (int lx = 0; lx < w; lx += (ly == 0 || ly == h - 1) ? 1 : std::max(1, w - 1))
+            setPerimeter(out.sideFlats, w, h, lx, ly, flat[(size_t)(ly + 1) * (w + 2) + lx + 1]);
+    }
+    return true;
+}
+
+void TileGraph::solveFlats(const std::vector<FlatSummary>& summaries)
+{
+    flatRank.assign(offsets.back(), 0);
+
+    // Number the flats globally and join those meeting across a tile edge
+    std::vector<uint32_t> base(tiles.count() + 1, 0);
+    for (int t = 0; t < tiles.count(); t++)
+        base[t + 1] = base[t] + (summaries[t].sideFlats.empty() ? 0 : summaries[t].exits.size());
+    const uint32_t flats = base.back();
+    std::vector<std::pair<uint32_t, uint32_t>> joins;
+    for (int t = 0; t < tiles.count(); t++)
+    {
+        const FlatSummary& s = summaries[t];
+        if (s.sideFlats.empty())
+            continue;
+        int x0, y0, w, h;
+        tiles.window(t, x0, y0, w, h);
+        for (int ly = 0; ly < h; ly++)
+        {
+            for (int lx = 0; lx < w; lx += (ly == 0 || ly == h - 1) ? 1 : std::max(1, w - 1))
+            {
+                size_t p = perimeterSlot(w, h, lx, ly);
+                if (s.sideFlats[p] == 0)
+                    continue;
+                for (int d = 0; d < 8; d++)
+                {
+                    int x = x0 + lx + ngh[d].dx, y = y0 + ly + ngh[d].dy;
+                    if (x < 0 || x >= tiles.xSize || y < 0 || y >= tiles.ySize)
+                        continue;
+                    int tn = tiles.tileAt(x, y);
+                    if (tn <= t || summaries[tn].sideFlats.empty())
+                        continue;
+                    int nx0, ny0, nw, nh;
+                    tiles.window(tn, nx0, ny0, nw, nh);
+                    size_t q = perimeterSlot(nw, nh, x - nx0, y - ny0);
+                    uint32_t fn = summaries[tn].sideFlats[q];
+                    if (fn != 0 && perimeter[offsets[tn] + q] == perimeter[offsets[t] + p])
+                        joins.push_back(std::make_pair(base[t] + s.sideFlats[p] - 1, base[tn] + fn - 1));
+                }
+            }
+        }
+    }
+    std::vector<size_t> first(flats + 1, 0);
+    for (const auto& j : joins)
+    {
+        first[j.first + 1]++;
+        first[j.second + 1]++;
+    }
+    for (uint32_t f = 0; f < flats; f++)
+        first[f + 1] += first[f];
+    std::vector<uint32_t> adjacent(first[flats]);
+    std::vector<size_t> fill(first.begin(), first.end() - 1);
+    for (const auto& j : joins)
+    {
+        adjacent[fill[j.first]++] = j.second;
+        adjacent[fill[j.second]++] = j.first;
+    }
+
+    // Breadth-first from the flats draining within their tile: every other
+    // flat drains into a neighbour one rank below
+    std::vector<uint32_t> rank(flats, unranked);
+    std::vector<uint32_t> queue;
+    for (int t = 0; t < tiles.count(); t++)
+    {
+        for (size_t f = 0; f < summaries[t].exits.size() && !summaries[t].sideFlats.empty(); f++)
+        {
+            if (summaries[t].exits[f])
+            {
+                rank[base[t] + f] = 0;
+                queue.push_back(base[t] + f);
+            }
+        }
+    }
+    for (size_t i = 0; i < queue.size(); i++)
+    {
+        uint32_t f = queue[i];
+        for (size_t k = first[f]; k < first[f + 1]; k++)
+        {
+            if (rank[adjacent[k]] == unranked)
+            {
+                rank[adjacent[k]] = rank[f] + 1;
+                queue.push_back(adjacent[k]);
+            }
+        }
+    }
+
+    for (int t = 0; t < tiles.count(); t++)
+    {
+        const FlatSummary& s = summaries[t];
+        for (size_t p = 0; p < s.sideFlats.size(); p++)
+        {
+            if (s.sideFlats[p] != 0)
+                flatRank[offsets[t] + p] = rank[base[t] + s.sideFlats[p] - 1];
+        }
+    }
+}
+
+bool TileGraph::save(const std::string& path) const
+{
+    FILE* f = fopen(path.c_str(), "wb");
+    if (f == nullptr)
+        return false;
+    int32_t header[3] = { tiles.xSize, tiles.ySize, tiles.tileSize };
+    fwrite(graphMagic, 1, 4, f);
+    fwrite(&graphVersion, sizeof(graphVersion), 1, f);
+    fwrite(header, sizeof(int32_t), 3, f);
+    fwrite(&nodataValue, sizeof(float), 1, f);
+    fwrite(perimeter.data(), sizeof(float), perimeter.size(), f);
+    fwrite(flatRank.data(), sizeof(uint32_t), flatRank.size(), f);
+    bool ok = !ferror(f);
+    return (fclose(f) == 0) && ok;
+}
+
+bool TileGraph::open(const std::string& path)
+{
+    if (file)
+        fclose(file);
+    file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+    char magic[4];
+    uint32_t version;
+    int32_t header[3];
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, graphMagic, 4) != 0
+        || fread(&version, sizeof(version), 1, file) != 1 || version != graphVersion
+        || fread(header, sizeof(int32_t), 3, file) != 3 || header[0] <= 0 || header[1] <= 0 || header[2] <= 0
+        || fread(&nodataValue, sizeof(float), 1, file) != 1)
+    {
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+    tiles = TileLayout(header[0], header[1], header[2]);
+    computeOffsets();
+    perimeter.clear();
+    flatRank.clear();
+    dataStart = ftell(file);
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) != dataStart + (long)(offsets.back() * (sizeof(float) + sizeof(uint32_t))))
+    {
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool TileGraph::tilePerimeter(int t, std::vector<float>& values) const
+{
+    values.resize(offsets[t + 1] - offsets[t]);
+    if (!perimeter.empty())
+    {
+        std::copy(perimeter.begin() + offsets[t], perimeter.begin() + offsets[t + 1], values.begin());
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(fileLock);
+    return file && fseek(file, dataStart + (long)(offsets[t] * sizeof(float)), SEEK_SET) == 0
+        && fread(values.data(), sizeof(float), values.size(), file) == values.size();
+}
+
+void TileGraph::setTilePerimeter(int t, const std::vector<float>& values)
+{
+    std::copy(values.begin(), values.end(), perimeter.begin() + offsets[t]);
+}
+
+bool TileGraph::tileFlatRanks(int t, std::vector<uint32_t>& ranks) const
+{
+    ranks.resize(offsets[t + 1] - offsets[t]);
+    if (!perimeter.empty())
+    {
+        std::copy(flatRank.begin() + offsets[t], flatRank.begin() + offsets[t + 1], ranks.begin());
+        return true;
+    }
+    // Stored after all the perimeters
+    std::lock_guard<std::mutex> lock(fileLock);
+    return file && fseek(file, dataStart + (long)(offsets.back() * sizeof(float) + offsets[t] * sizeof(uint32_t)),
+                         SEEK_SET) == 0
+        && fread(ranks.data(), sizeof(uint32_t), ranks.size(), file) == ranks.size();
+}
+
+void TileGraph::setTileFlatRanks(int t, const std::vector<uint32_t>& ranks)
+{
+    std::copy(ranks.begin(), ranks.end(), flatRank.begin() + offsets[t]);
+}
+
+bool TileGraph::floodTile(int t, const WindowReader& read, const FillParams& params, int stage, float* elev,
+                          std::vector<float>& halo, std::vector<unsigned char>& haloFlow,
+                          std::vector<uint32_t>* haloRanks) const
+{
+    int x0, y0, w, h;
+    tiles.window(t, x0, y0, w, h);
+    if (!read(x0, y0, w, h, elev))
+        return false;
+
+    // The tile inside a fixed border made of the filled perimeter cells of
+    // its neighbours, nodata outside the DEM
+    const int hw = w + 2, hh = h + 2;
+    halo.assign((size_t)hw * hh, nodataValue);
+    for (int y = 0; y < h; y++)
+        std::copy(elev + (size_t)y * w, elev + (size_t)(y + 1) * w, halo.begin() + (size_t)(y + 1) * hw + 1);
+    if (haloRanks)
+        haloRanks->assign(halo.size(), 0);
+
+    int loaded = -1, nx0 = 0, ny0 = 0, nw = 0, nh = 0;
+    std::vector<float> values;
+    std::vector<uint32_t> ranks;
+    for (int hy = 0; hy < hh; hy++)
+    {
+        for (int hx = 0; hx < hw; hx += (hy == 0 || hy == hh - 1) ? 1 : hw - 1)
+        {
+            int x = x0 + hx - 1, y = y0 + hy - 1;
+            if (x < 0 || x >= tiles.xSize || y < 0 || y >= tiles.ySize)
+                continue;
+            int tn = tiles.tileAt(x, y);
+            if (tn != loaded)
+            {
+                if (!tilePerimeter(tn, values) || (haloRanks && !tileFlatRanks(tn, ranks)))
+                    return false;
+                loaded = tn;
+                tiles.window(tn, nx0, ny0, nw, nh);
+            }
+            size_t slot = perimeterSlot(nw, nh, x - nx0, y - ny0);
+            halo[(size_t)hy * hw + hx] = values[slot];
+            if (haloRanks)
+                (*haloRanks)[(size_t)hy * hw + hx] = ranks[slot];
+        }
+    }
+
+    SPILLDEM_PROBE2(tile__start, t, stage);
+    FillParams local = params;
+    local.trace = nullptr;
+    haloFlow.resize(halo.size());
+    fillPriorityFlood(halo.data(), haloFlow.data(), hw, hh, local);
+    SPILLDEM_PROBE2(tile__end, t, stage);
+    return true;
+}
+
+bool TileGraph::fillTile(int t, const WindowReader& read, const FillParams& params,
+                         float* elev, unsigned char* flowdir) const
+{
+    if (params.minslope > 0.0f || t < 0 || t >= tiles.count())
+        return false;
+    int x0, y0, w, h;
+    tiles.window(t, x0, y0, w, h);
+    const int hw = w + 2;
+    std::vector<float> halo;
+    std::vector<unsigned char> haloFlow;
+    std::vector<uint32_t> haloRanks;
+    if (!floodTile(t, read, params, 1, elev, halo, haloFlow, &haloRanks))
+        return false;
+
+    // Flats crossing the tile edge drain by decreasing rank: those of rank 0
+    // within the tile, the others into the cells of rank one less across
+    // the edge, and the rest of each flat towards those, breadth-first
+    std::vector<uint32_t> flat, own;
+    std::vector<size_t> cells;
+    std::vector<unsigned char> exits;
+    if (findFlats(halo, haloFlow, w, h, nodataValue, flat, cells, exits))
+    {
+        if (!tileFlatRanks(t, own))
+            return false;
+        std::vector<uint32_t> rank(exits.size() + 1, unranked);
+        for (int ly = 0; ly < h; ly++)
+        {
+            for (int lx = 0; lx < w; lx += (ly == 0 || ly == h - 1) ? 1 : std::max(1, w - 1))
+            {
+                uint32_t id = flat[(size_t)(ly + 1) * hw + lx + 1];
+                if (id)
+                    rank[id] = own[perimeterSlot(w, h, lx, ly)];
+            }
+        }
+        const double dx = std::fabs(params.pixelSizeX), dy = std::fabs(params.pixelSizeY);
+        const double length[8] = {dx, std::hypot(dx, dy), dy, std::hypot(dx, dy),
+                                  dx, std::hypot(dx, dy), dy, std::hypot(dx, dy)};
+        std::vector<unsigned char> swept(halo.size(), 0);
+        std::vector<size_t> sweep;
+        for (size_t m : cells)
+        {
+            const uint32_t r = rank[flat[m]];
+            if (r == unranked)
+                continue;
+            const float z = halo[m];
+            const int mx = m % hw, my = m / hw;
+            int to = -1;
+            if (r == 0)
+            {
+                // An outlet, else towards the steepest of the lower neighbours
+                double steepest = 0.0;
+                if (haloFlow[m] == 255)
+                    to = 8;
+                for (int d = 0; d < 8 && to != 8; d++)
+                {
+                    size_t n = (size_t)(my + ngh[d].dy) * hw + mx + ngh[d].dx;
+                    if (halo[n] != nodataValue && halo[n] < z && (z - halo[n]) / length[d] > steepest)
+                    {
+                        steepest = (z - halo[n]) / length[d];
+                        to = d;
+                    }
+                }
+            }
+            else
+            {
+                for (int d = 0; d < 8 && to < 0; d++)
+                {
+                    int nx = mx + ngh[d].dx, ny = my + ngh[d].dy;
+                    size_t n = (size_t)ny * hw + nx;
+                    bool ring = nx == 0 || nx == w + 1 || ny == 0 || ny == h + 1;
+                    if (ring && halo[n] == z && haloRanks[n] == r - 1)
+                        to = d;
+                }
+            }
+            if (to < 0)
+                continue;
+            if (to < 8)
+                haloFlow[m] = ldd[to];
+            swept[m] = 1;
+            sweep.push_back(m);
+        }
+        for (size_t i = 0; i < sweep.size(); i++)
+        {
+            const size_t m = sweep[i];
+            for (int d = 0; d < 8; d++)
+            {
+                size_t n = (size_t)(m / hw + ngh[d].dy) * hw + m % hw + ngh[d].dx;
+                if (flat[n] == flat[m] && !swept[n])
+                {
+                    swept[n] = 1;
+                    haloFlow[n] = ldd[(d + 4) % 8];
+                    sweep.push_back(n);
+                }
+            }
+        }
+    }
+
+    for (int y = 0; y < h; y++)
+    {
+        std::copy(halo.begin() + (size_t)(y + 1) * hw + 1, halo.begin() + (size_t)(y + 1) * hw + 1 + w,
+                  elev + (size_t)y * w);
+        std::copy(haloFlow.begin() + (size_t)(y + 1) * hw + 1, haloFlow.begin() + (size_t)(y + 1) * hw + 1 + w,
+                  flowdir + (size_t)y * w);
+    }
+    return true;
+}
+
+bool fillTiled(const TileGraph& graph, const WindowReader& read, const FillParams& params,
+               const TileSink& sink, FillStats* stats)
+{
+    std::vector<int> all(graph.layout().count());
+    for (size_t t = 0; t < all.size(); t++)
+        all[t] = t;
+    return fillTiled(graph, all, read, params, sink, stats);
+}
+
+bool fillTiled(const TileGraph& graph, const std::vector<int>& subset, const WindowReader& read,
+               const FillParams& params, const TileSink& sink, FillStats* stats)
+{
+    Timer timer;
+    const TileLayout& tiles = graph.layout();
+    std::atomic<bool> ok(true);
+    parallelFor(params.threads, subset.size(), [&](size_t i)
+    {
+        int t = subset[i], x0, y0, w, h;
+        tiles.window(t, x0, y0, w, h);
+        std::vector<float> elev((size_t)w * h);
+        std::vector<unsigned char> flowdir((size_t)w * h);
+        if (!ok || !graph.fillTile(t, read, params, elev.data(), flowdir.data()))
+        {
+            ok = false;
+            return;
+        }
+        sink(x0, y0, w, h, elev.data(), flowdir.data());
+    });
+    if (stats)
+        stats->addPhase("fill", timer.lap());
+    return ok;
+}
+
+bool fillTiledStreaming(int xSize, int ySize, const WindowReader& read, const FillParams& params,
+                        const TileSink& sink, FillStats* stats)
+{
+    TileGraph graph;
+    return graph.build(TileLayout(xSize, ySize, params.tileSize), read, params.nodata, params.threads, stats)
+        && fillTiled(graph, read, params, sink, stats);
+}
+
+void fillTiledInMemory(float* elev, unsigned char* flowdir, int xSize, int ySize,
+                       const FillParams& params, FillStats* stats)
+{
+    // Every tile only reads its own window once the graph is built, before
+    // writing it back, so the buffer can be filled in place
+    WindowReader read = [&](int x0, int y0, int w, int h, float* buffer)
+    {
+        for (int y = 0; y < h; y++)
+            std::copy(elev + (size_t)(y0 + y) * xSize + x0, elev + (size_t)(y0 + y) * xSize + x0 + w,
+                      buffer + (size_t)y * w);
+        return true;
+    };
+    TileSink sink = [&](int x0, int y0, int w, int h, const float* tileElev, const unsigned char* tileFlow)
+    {
+        for (int y = 0; y < h; y++)
+        {
+            std::copy(tileElev + (size_t)y * w, tileElev + (size_t)(y + 1) * w, elev + (size_t)(y0 + y) * xSize + x0);
+            std::copy(tileFlow + (size_t)y * w, tileFlow + (size_t)(y + 1) * w, flowdir + (size_t)(y0 + y) * xSize + x0);
+        }
+        if (params.tileSink)
+            (*params.tileSink)(x0, y0, w, h, tileElev, tileFlow);
+    };
+    fillTiledStreaming(xSize, ySize, read, params, sink, stats);
+}
@@ -0,0 +1,173 @@
+/***************************************************************
+#                      spillDEM tiled filling                  #
+****************************************************************
+#                                                              #
+#     Exact tiled depression filling after Barnes (2016),      #
+#   "Parallel Priority-Flood depression filling for trillion   #
+#   cell digital elevation models".                            #
+#                                                              #
+#     A first pass floods every tile on its own, labelling     #
+#   the watershed of each perimeter cell, and joins the        #
+#   labels into a global spill graph. Solving that graph gives #
+#   the filled elevation of every tile perimeter cell, which   #
+#   is all that needs to be kept: any single tile can then be  #
+#   filled exactly by flooding it with its neighbours'         #
+#   perimeter cells as a fixed halo.                           #
+#                                                              #
+#     Flats of the filled DEM crossing a tile edge need one    #
+#   more step for the flow directions: the tiles holding them  #
+#   are flooded again and the flats ordered globally by their  #
+#   distance, in tiles, to one that drains, so that neighbours #
+#   agree on the way a shared flat drains.                     #
+#                                                              #
+#     Only flat filling (minslope 0) is supported, gradient    #
+#   preservation does not decompose over tiles.                #
+#                                                              #
+***************************************************************/
+
+#ifndef SPILLDEM_TILES_H
+#define SPILLDEM_TILES_H
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+#include "fill.h"
+
+// Reads the window [x0, x0 + w) x [y0, y0 + h) of the source DEM as
+// Float32 into buffer, rows w values apart. Called concurrently.
+typedef std::function<bool(int x0, int y0, int w, int h, float* buffer)> WindowReader;
+
+struct TileLayout
+{
+    int xSize = 0;
+    int ySize = 0;
+    int tileSize = 0;
+    int xTiles = 0;
+    int yTiles = 0;
+
+    TileLayout() {}
+    TileLayout(int xSize, int ySize, int tileSize);
+
+    int count() const { return xTiles * yTiles; }
+    int tileAt(int x, int y) const { return (y / tileSize) * xTiles + x / tileSize; }
+    void window(int t, int& x0, int& y0, int& w, int& h) const;
+};
+
+// Result of flooding one tile on its own, all the spill graph needs to
+// know about it
+struct TileSummary
+{
+    uint32_t labels = 0;              // highest local label
+    std::vector<uint32_t> sideLabels; // label of every perimeter cell, 0 for nodata
+    std::vector<float> sideElev;      // elevation of every perimeter cell
+    std::vector<std::pair<uint64_t, float>> edges; // spill elevation between two local labels
+};
+
+// Flood tile t on its own, labelling the watershed of each perimeter cell
+bool summarizeTile(const TileLayout& layout, int t, const WindowReader& read, float nodata, TileSummary& out);
+
+// Flats of a filled tile crossing its edge: connected cells of equal filled
+// elevation, one of them next to a cell of that elevation in a neighbouring
+// tile
+struct FlatSummary
+{
+    std::vector<uint32_t> sideFlats;  // flat of every perimeter cell, 0 for none, empty without flats
+    std::vector<unsigned char> exits; // for flats 1, 2, ...: 1 when the flat drains within the tile
+};
+
+class TileGraph
+{
+public:
+    TileGraph() {}
+    ~TileGraph();
+
+    // Flood every tile and solve the global spill graph
+    bool build(const TileLayout& layout, const WindowReader& read, float nodata, int threads,
+               FillStats* stats = nullptr);
+
+    // Solve the global spill graph from the summaries of all the tiles
+    void solve(const TileLayout& layout, float nodata, const std::vector<TileSummary>& summaries);
+    // Empty graph, every perimeter cell nodata until set
+    void reset(const TileLayout& layout, float nodata);
+
+    // Whether a filled perimeter cell of tile t has the elevation of a
+    // neighbour in another tile, so that a flat may cross the tile edge
+    bool crossesFlat(int t) const;
+    // Flood tile t through the solved perimeters and find its flats
+    // crossing the tile edge
+    bool summarizeFlats(int t, const WindowReader& read, FlatSummary& out) const;
+    // Rank the flats crossing tile edges from the summaries of all the
+    // tiles, empty for tiles without such flats
+    void solveFlats(const std::vector<FlatSummary>& summaries);
+
+    bool save(const std::string& path) const;
+    // Opens a saved graph. Perimeters are then read from the file on demand,
+    // so opening is cheap whatever the size of the DEM.
+    bool open(const std::string& path);
+
+    // Fill tile t exactly. elev and flowdir receive the tile window, the
+    // flow directions of cells draining into a neighbouring tile point
+    // across the tile edge.
+    bool fillTile(int t, const WindowReader& read, const FillParams& params,
+                  float* elev, unsigned char* flowdir) const;
+
+    // Filled perimeter of tile t, in the order described below
+    bool tilePerimeter(int t, std::vector<float>& values) const;
+    void setTilePerimeter(int t, const std::vector<float>& values);
+    // Rank of the flat of every perimeter cell of tile t, same order
+    bool tileFlatRanks(int t, std::vector<uint32_t>& ranks) const;
+    void setTileFlatRanks(int t, const std::vector<uint32_t>& ranks);
+
+    const TileLayout& layout() const { return tiles; }
+    float nodata() const { return nodataValue; }
+
+private:
+    TileGraph(const TileGraph&);
+    TileGraph& operator=(const TileGraph&);
+
+    void computeOffsets();
+    // The tile, read through elev, inside a border made of the filled
+    // perimeter cells of its neighbours and flooded; haloRanks receives the
+    // flat ranks of the border when given. stage is that of the tile probes.
+    bool floodTile(int t, const WindowReader& read, const FillParams& params, int stage, float* elev,
+                   std::vector<float>& halo, std::vector<unsigned char>& haloFlow,
+                   std::vector<uint32_t>* haloRanks) const;
+
+    TileLayout tiles;
+    float nodataValue = 0.0f;
+    // Filled elevation of the perimeter cells of every tile: top row,
+    // bottom row, left column then right column
+    std::vector<float> perimeter;
+    // Distance in tiles from the flat of every perimeter cell crossing a
+    // tile edge to a tile where that flat drains, same order
+    std::vector<uint32_t> flatRank;
+    std::vector<size_t> offsets;
+    FILE* file = nullptr;
+    long dataStart = 0;
+};
+
+// Fill every tile of the DEM through the graph, in parallel, and hand each
+// tile to sink as soon as it is done. sink is called concurrently.
+bool fillTiled(const TileGraph& graph, const WindowReader& read, const FillParams& params,
+               const TileSink& sink, FillStats* stats = nullptr);
+// Same for the listed tiles only
+bool fillTiled(const TileGraph& graph, const std::vector<int>& subset, const WindowReader& read,
+               const FillParams& params, const TileSink& sink, FillStats* stats = nullptr);
+
+// Streaming entry point of the library: build the spill graph of the DEM
+// behind read, then fill it tile by tile, handing every tile to sink as
+// soon as it is final so that it can be written, compressed or uploaded
+// while the other tiles are being filled. Neither the DEM nor the result
+// is ever held in memory as a whole.
+bool fillTiledStreaming(int xSize, int ySize, const WindowReader& read, const FillParams& params,
+                        const TileSink& sink, FillStats* stats = nullptr);
+
+// In-memory tiled engine, for the engine table and the benchmarks. Tiles
+// are also handed to params.tileSink when set, once copied back to elev
+// and flowdir.
+void fillTiledInMemory(float* elev, unsigned char* flowdir, int xSize, int ySize,
+                       const FillParams& params, FillStats* stats = nullptr);
+
+#endif
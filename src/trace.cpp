@@ -0,0 +1,142 @@
+#include <cstring>
+#include "trace.h"
+
+static const char traceMagic[4] = {'S', 'P', 'Q', 'T'};
+static const uint32_t traceVersion = 1;
+static const int pushAbsolute = 8;
+static const int popRecord = 9;
+
+bool QueueTrace::open(const std::string& path, int xSize, int ySize)
+{
+    close();
+    file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+    setvbuf(file, nullptr, _IOFBF, 1 << 20);
+    int32_t size[2] = { xSize, ySize };
+    fwrite(traceMagic, 1, 4, file);
+    fwrite(&traceVersion, sizeof(traceVersion), 1, file);
+    fwrite(size, sizeof(int32_t), 2, file);
+    for (int d = 0; d < 8; d++)
+        offsets[d] = ngh[d].dx + (int64_t)ngh[d].dy * xSize;
+    lastPop = lastPush = 0;
+    return !ferror(file);
+}
+
+bool QueueTrace::close()
+{
+    if (file == nullptr)
+        return true;
+    bool ok = !ferror(file);
+    ok = (fclose(file) == 0) && ok;
+    file = nullptr;
+    return ok;
+}
+
+void QueueTrace::putVarint(int64_t value)
+{
+    uint64_t v = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    while (v >= 0x80)
+    {
+        putc(int(v & 0x7f) | 0x80, file);
+        v >>= 7;
+    }
+    putc(int(v), file);
+}
+
+void QueueTrace::push(int64_t index, float spill)
+{
+    int code = pushAbsolute;
+    for (int d = 0; d < 8; d++)
+    {
+        if (index - lastPop == offsets[d])
+        {
+            code = d;
+            break;
+        }
+    }
+    putc(code, file);
+    if (code == pushAbsolute)
+    {
+        putVarint(index - lastPush);
+        lastPush = index;
+    }
+    fwrite(&spill, sizeof(float), 1, file);
+}
+
+void QueueTrace::pop(int64_t index)
+{
+    putc(popRecord, file);
+    putVarint(index - lastPop);
+    lastPop = index;
+}
+
+static bool getVarint(FILE* file, int64_t& value)
+{
+    uint64_t v = 0;
+    int c, shift = 0;
+    do
+    {
+        if ((c = getc(file)) == EOF || shift > 63)
+            return false;
+        v |= uint64_t(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    value = int64_t(v >> 1) ^ -int64_t(v & 1);
+    return true;
+}
+
+bool readQueueTrace(const std::string& path, int& xSize, int& ySize, std::vector<node>& ops)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+    setvbuf(file, nullptr, _IOFBF, 1 << 20);
+    char magic[4];
+    uint32_t version;
+    int32_t size[2];
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, traceMagic, 4) != 0
+        || fread(&version, sizeof(version), 1, file) != 1 || version != traceVersion
+        || fread(size, sizeof(int32_t), 2, file) != 2 || size[0] <= 0 || size[1] <= 0)
+    {
+        fclose(file);
+        return false;
+    }
+    xSize = size[0];
+    ySize = size[1];
+    const int64_t cells = (int64_t)xSize * ySize;
+
+    int64_t lastPop = 0, lastPush = 0, delta, index;
+    float spill;
+    int code;
+    bool ok = true;
+    ops.clear();
+    while (ok && (code = getc(file)) != EOF)
+    {
+        if (code == popRecord)
+        {
+            ok = getVarint(file, delta);
+            lastPop += delta;
+            ops.push_back(node(0.0f, -1, 0));
+            continue;
+        }
+        if (code < 8)
+        {
+            index = lastPop + ngh[code].dx + (int64_t)ngh[code].dy * xSize;
+        }
+        else if (code == pushAbsolute && getVarint(file, delta))
+        {
+            lastPush += delta;
+            index = lastPush;
+        }
+        else
+        {
+            ok = false;
+            break;
+        }
+        ok = fread(&spill, sizeof(float), 1, file) == 1 && index >= 0 && index < cells;
+        ops.push_back(node(spill, int(index % xSize), int(index / xSize)));
+    }
+    fclose(file);
+    return ok;
+}
@@ -0,0 +1,146 @@
+/***************************************************************
+#                    spillDEM queue traces                     #
+****************************************************************
+#                                                              #
+#     Record of the push/pop sequence of a flood, so that      #
+#   queue implementations can be benchmarked on real access    #
+#   patterns without the DEM or any I/O.                       #
+#                                                              #
+#     File layout: "SPQT", uint32 version, int32 xSize,        #
+#   int32 ySize, then one record per queue operation:          #
+#     0-7  push of neighbour d of the last popped cell,        #
+#          float32 spill                                       #
+#     8    push of any other cell, zigzag varint index delta   #
+#          from the previous such push, float32 spill          #
+#     9    pop, zigzag varint index delta from the previous    #
+#          pop                                                 #
+#                                                              #
+***************************************************************/
+
+#ifndef SPILLDEM_TRACE_H
+#define SPILLDEM_TRACE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "fill.h"
+#include "queues.h"
+
+class QueueTrace
+{
+public:
+    QueueTrace() {}
+    ~QueueTrace() { close(); }
+
+    bool open(const std::string& path, int xSize, int ySize);
+    bool close();
+
+    void push(int64_t index, float spill);
+    void pop(int64_t index);
+
+private:
+    QueueTrace(const QueueTrace&);
+    QueueTrace& operator=(const QueueTrace&);
+
+    void putVarint(int64_t value);
+
+    FILE* file = nullptr;
+    int64_t offsets[8];
+    int64_t lastPop = 0;
+    int64_t lastPush = 0;
+};
+
+// Queue adaptor recording every operation forwarded to the wrapped queue
+template <class Queue>
+class TracedQueue
+{
+public:
+    TracedQueue(Queue& queue, QueueTrace& trace, int xSize)
+        : queue(queue), trace(trace), xSize(xSize)
+    {}
+
+    bool empty() const { return queue.empty(); }
+    size_t size() const { return queue.size(); }
+    const node& top() const { return queue.top(); }
+
+    void push(const node& n)
+    {
+        trace.push((int64_t)n.y * xSize + n.x, n.spill);
+        queue.push(n);
+    }
+
+    void pop()
+    {
+        const node& n = queue.top();
+        trace.pop((int64_t)n.y * xSize + n.x);
+        queue.pop();
+    }
+
+private:
+    Queue& queue;
+    QueueTrace& trace;
+    int xSize;
+};
+
+// Queue firing the queue__push and queue__pop probes, used in place of
+// Queue when they are built in
+template <class Queue>
+class ProbedQueue : public Queue
+{
+public:
+    void push(const node& n)
+    {
+        SPILLDEM_PROBE2(queue__push, n.x, n.y);
+        Queue::push(n);
+    }
+
+    void pop()
+    {
+        SPILLDEM_PROBE2(queue__pop, this->top().x, this->top().y);
+        Queue::pop();
+    }
+};
+
+// Call flood(queue) with the queue implementation selected in params,
+// wrapped to record its operations when params asks for a trace. flood is a
+// functor with a templated call operator.
+template <class Queue, class Flood>
+void floodWithQueue(const FillParams& params, int xSize, Flood& flood)
+{
+#ifdef SPILLDEM_PROBES
+    typedef ProbedQueue<Queue> Selected;
+#else
+    typedef Queue Selected;
+#endif
+    Selected queue;
+    if (params.trace)
+    {
+        TracedQueue<Selected> traced(queue, *params.trace, xSize);
+        flood(traced);
+    }
+    else
+    {
+        flood(queue);
+    }
+}
+
+template <class Flood>
+void floodWithSelectedQueue(const FillParams& params, int xSize, Flood& flood)
+{
+    switch (params.queue)
+    {
+    case QueueKind::Binary:
+        floodWithQueue<std::priority_queue<node>>(params, xSize, flood);
+        break;
+    case QueueKind::Quaternary:
+        floodWithQueue<DaryHeap<node, 4>>(params, xSize, flood);
+        break;
+    }
+}
+
+// Decode a whole trace. Pushes are returned as the pushed node, pops as a
+// node with x == -1.
+bool readQueueTrace(const std::string& path, int& xSize, int& ySize, std::vector<node>& ops);
+
+#endif
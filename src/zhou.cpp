@@ -0,0 +1,265 @@
+/***************************************************************
+#                  spillDEM region growing engine              #
+****************************************************************
+#                                                              #
+#     Priority-Flood variant of [Zhou, Sun & Fu (2016)]        #
+#   (http://dx.doi.org/10.1016/j.cageo.2016.04.015). Cells     #
+#   reached from below that can drain without being raised     #
+#   are classified on the fly and handled by region growing    #
+#   with a plain FIFO queue. Only the spill boundaries of      #
+#   depressions go through the priority queue, and with flat   #
+#   filling the depression cells themselves are also grown     #
+#   with a FIFO queue since they all take the same elevation.  #
+#                                                              #
+***************************************************************/
+
+#include <cmath>
+#include <deque>
+#include "fill.h"
+#include "trace.h"
+
+template <class Queue>
+static void regionGrowingFlood(float* elev, unsigned char* flowdir, int xSize, int ySize,
+                               const FillParams& params, Queue& queue, FillStats* stats)
+{
+    Timer timer;
+    const float nodata = params.nodata;
+    bool preserve;
+    float minslope = params.minslope;
+    // Pixel sizes as distances, north-up rasters have a negative pixel height
+    float pixelSizeX = std::fabs(params.pixelSizeX), pixelSizeY = std::fabs(params.pixelSizeY);
+    float diaglength = std::sqrt(pixelSizeX * pixelSizeX + pixelSizeY * pixelSizeY);
+    std::array<float, 8> length = { pixelSizeX, diaglength, pixelSizeY,
+                                    diaglength, pixelSizeX, diaglength,
+                                    pixelSizeY, diaglength};
+    std::array<float, 8> mindiff;
+
+    if( minslope > 0.0 )
+    {
+        minslope = std::tan(minslope * M_PI / 180.0);
+        for(int d=0; d<8; d++)
+            mindiff[d] = minslope * length[d];
+        preserve = true;
+    }
+    else
+    {
+        mindiff.fill(0.0f);
+        preserve = false;
+    }
+
+    // Past the east and west edges, either outside or around the globe
+    const bool wrapX = params.wrapX;
+    auto getNeighbourX = [&](int x, int d)
+    {
+        x += ngh[d].dx;
+        return !wrapX ? x : x < 0 ? x + xSize : x >= xSize ? x - xSize : x;
+    };
+    auto getNeighbourY = [&](int y, int d){ return y + ngh[d].dy; };
+    auto getIndex = [&](int x, int y){ return y * xSize + x; };
+    auto isInBounds = [&](int x, int y){ return x >= 0 && x < xSize && y >= 0 && y < ySize; };
+    // A neighbour at nz must be raised to drain through a cell at z
+    auto mustRaise = [&](float nz, float z, int d){ return preserve ? nz < z + mindiff[d] : nz <= z; };
+
+    // Set once the final elevation of a cell is known
+    std::vector<bool> closed(xSize*ySize, false);
+    std::deque<int> pit, slope;
+    std::fill(flowdir, flowdir + (size_t)xSize*ySize, 0);
+
+    auto getFlowDir = [&](int x, int y, float z)
+    {
+        float maxgrad = -1.0, grad;
+        char dmax = 8;
+        int nx, ny, n;
+        for (int d = 0; d < 8; d++)
+        {
+            nx = getNeighbourX(x, d);
+            ny = getNeighbourY(y, d);
+            n = getIndex(nx ,ny);
+            if ( isInBounds(nx, ny) && closed[n] && elev[n] <= z)
+            {
+                grad = (z - elev[n]) / length[d];
+                if (grad > maxgrad)
+                {
+                    maxgrad = grad;
+                    dmax = d;
+                }
+            }
+        }
+        return dmax;
+    };
+
+    int n, nx, ny;
+    float z;
+    size_t pushes = 0, pops = 0, grown = 0;
+
+    // Initialize edge cells
+    for (int x = 0; x < xSize; x++)
+    {
+        for (int y = 0; y < ySize; y++)
+        {
+            int c = getIndex(x, y);
+            if (elev[c] == nodata)
+            {
+                closed[c] = true;
+                flowdir[c] = 255;
+                continue;
+            }
+            for (int d = 0; d < 8; d++)
+            {
+                nx = getNeighbourX(x, d);
+                ny = getNeighbourY(y, d);
+                if ( !isInBounds(nx, ny) || elev[getIndex(nx, ny)] == nodata )
+                {
+                    flowdir[c] = 255;
+                    queue.push(node(elev[c], x, y));
+                    closed[c] = true;
+                    pushes++;
+                    break;
+                }
+            }
+        }
+    }
+    if (stats)
+        stats->addPhase("init", timer.lap());
+
+    // Raise the neighbour n of (x, y) to drain through it. With flat filling
+    // the neighbour joins the depression being grown, with gradient
+    // preservation the raised elevations differ and the priority queue
+    // keeps them in order.
+    auto raise = [&](int x, int y, int d, int n, float z)
+    {
+        if (preserve)
+        {
+            elev[n] = z + mindiff[d];
+            queue.push(node(elev[n], getNeighbourX(x, d), getNeighbourY(y, d)));
+            pushes++;
+        }
+        else
+        {
+            elev[n] = z;
+            flowdir[n] = ldd[(d+4)%8];
+            pit.push_back(n);
+        }
+    };
+
+    while (!queue.empty())
+    {
+        node current = queue.top();
+        queue.pop();
+        pops++;
+        int c = getIndex(current.x, current.y);
+        z = current.spill;
+        for (int d = 0; d < 8; d++)
+        {
+            nx = getNeighbourX(current.x, d);
+            ny = getNeighbourY(current.y, d);
+            n = getIndex(nx, ny);
+            if ( isInBounds(nx, ny) && !closed[n] )
+            {
+                closed[n] = true;
+                if (mustRaise(elev[n], z, d))
+                    raise(current.x, current.y, d, n, z);
+                else
+                    slope.push_back(n);
+            }
+        }
+        if (!flowdir[c]) // Record the steepest gradient direction if needed
+            flowdir[c] = ldd[getFlowDir(current.x, current.y, z)];
+
+        // Flat depression cells, all at the current spill elevation. Their
+        // higher neighbours are spill boundaries.
+        while (!pit.empty())
+        {
+            c = pit.front();
+            pit.pop_front();
+            grown++;
+            int x = c % xSize, y = c / xSize;
+            for (int d = 0; d < 8; d++)
+            {
+                nx = getNeighbourX(x, d);
+                ny = getNeighbourY(y, d);
+                n = getIndex(nx, ny);
+                if ( isInBounds(nx, ny) && !closed[n] )
+                {
+                    closed[n] = true;
+                    if (mustRaise(elev[n], z, d))
+                    {
+                        raise(x, y, d, n, z);
+                    }
+                    else
+                    {
+                        queue.push(node(elev[n], nx, ny));
+                        pushes++;
+                    }
+                }
+            }
+        }
+
+        // Cells draining into the flood without being raised. A cell with an
+        // open neighbour that would have to be raised through it is a spill
+        // boundary and goes back to the priority queue, otherwise all its
+        // open neighbours are higher and keep their elevation too.
+        while (!slope.empty())
+        {
+            c = slope.front();
+            slope.pop_front();
+            int x = c % xSize, y = c / xSize;
+            float cz = elev[c];
+            bool boundary = false;
+            for (int d = 0; d < 8 && !boundary; d++)
+            {
+                nx = getNeighbourX(x, d);
+                ny = getNeighbourY(y, d);
+                n = getIndex(nx, ny);
+                boundary = isInBounds(nx, ny) && !closed[n] && mustRaise(elev[n], cz, d);
+            }
+            if (boundary)
+            {
+                queue.push(node(cz, x, y));
+                pushes++;
+                continue;
+            }
+            grown++;
+            for (int d = 0; d < 8; d++)
+            {
+                nx = getNeighbourX(x, d);
+                ny = getNeighbourY(y, d);
+                n = getIndex(nx, ny);
+                if ( isInBounds(nx, ny) && !closed[n] )
+                {
+                    closed[n] = true;
+                    slope.push_back(n);
+                }
+            }
+            flowdir[c] = ldd[getFlowDir(x, y, cz)];
+        }
+    }
+    if (stats)
+    {
+        stats->addPhase("flood", timer.lap());
+        stats->pushes += pushes;
+        stats->pops += pops;
+    }
+}
+
+struct regiongrowing
+{
+    float* elev;
+    unsigned char* flowdir;
+    int xSize, ySize;
+    const FillParams& params;
+    FillStats* stats;
+
+    template <class Queue>
+    void operator()(Queue& queue)
+    {
+        regionGrowingFlood(elev, flowdir, xSize, ySize, params, queue, stats);
+    }
+};
+
+void fillRegionGrowing(float* elev, unsigned char* flowdir, int xSize, int ySize,
+                       const FillParams& params, FillStats* stats)
+{
+    regiongrowing flood = { elev, flowdir, xSize, ySize, params, stats };
+    floodWithSelectedQueue(params, xSize, flood);
+}